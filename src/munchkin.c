@@ -19,16 +19,63 @@ Version 1.2.5 SDL2 version (with full screen factor and harware rendering/scalin
 
 Choose start option, or press 1, Ctrl or joytick fire.
 
-Controls: Joystick or cursor keys
+Controls: Joystick, game controller (d-pad or left stick) or cursor keys
           Use 8 to toggle full-screen on/off (or use -f at command line)
+          F3 shows frame times and draw counts during the game
+          F5 keeps a snapshot of the game, F9 goes back to it
+          Backspace (or joystick button 2/3) held in arcade mode rewinds the game,
+          up to 30 seconds
           Esc to quit from game. Esc in start-screen to quit all.
           Character keys for entering high score name. Return to complete.
 
-Command line option: -fullscreen or -f to start in fullscreen.
+Command line options: -fullscreen or -f to start in fullscreen.
+                      --scale N      windowed size is N x 200x160 (default: largest that fits)
+                      --window WxH   windowed size in pixels (picture is centered)
+                      --software     no GPU: draw in memory, show only what changed
+                                     (also used when no accelerated renderer is found)
+                      --headless     no window and no sound device (SDL dummy drivers)
+                      --capture FILE write every frame to FILE (or pipe): Y4M video,
+                                     or PPM images when FILE ends in .ppm
+                      --frames N     quit after N frames (with --capture or --headless)
+                      --golden DIR   draw test scenes headless and compare with DIR/<scene>.ppm,
+                                     exit code 1 if one differs (writes DIR/<scene>_diff.ppm)
+                      --golden-record DIR   write the test scenes to DIR/<scene>.ppm
+                      --golden-tolerance N  allowed difference per colour value (default 8)
+                      --make-pack    write all images, sounds and the font to ../data/munchkin.pak
+                                     (used instead of the separate files when it is there)
+                      --make-embedded  also write the pack as munchkin_pak.h for -DMUNCHKIN_EMBED
+                      --audio-rate N     sample rate asked for (default 22050, the device may
+                                         choose its own, sounds are converted once at load)
+                      --audio-buffer N   samples per audio buffer, 128..8192 (default 1024)
+                      --audio-latency    measure play_sound() to mixed audio, shown with F3
+                                         and at exit (with the number of late buffers)
+                      --vsync            wait for the display refresh in present
+                      --autopilot        the munchkin plays by itself: arcade games started from
+                                         the title screen, for soak tests and benchmarks
+                      --input-latency    measure key/joystick press to the frame that took it
+                                         and to the end of its present, percentiles at exit
+                      --state FILE       F5 also writes the snapshot to FILE, the first game
+                                         starts from FILE when it is there
+                      --checkpoint N     with --state: write FILE every N seconds in the game
+                      --env-bench N      step N games without window with the env API,
+                                         prints the steps per second
 
 Compile and link in Linux:
 $ gcc -o munchkin munchkin.c -lSDL2 -lm -lSDL2_ttf -lSDL2_mixer
 
+Without SDL2_mixer (small built-in mixer for the sound effects, no libxmp etc.):
+$ gcc -DMUNCHKIN_OWN_MIXER -o munchkin munchkin.c -lSDL2 -lm -lSDL2_ttf
+
+Single binary with all images, sounds and the font inside (no files needed at all):
+$ ./munchkin --make-embedded      (writes ../data/munchkin.pak and munchkin_pak.h)
+$ gcc -DMUNCHKIN_EMBED -o munchkin munchkin.c -lSDL2 -lm -lSDL2_ttf -lSDL2_mixer
+
+Env API (many games without window or sound, for bots and training): add -DMUNCHKIN_ENV,
+         main() is left out, #include "munchkin.c" and use env_create(), env_reset(), env_step()
+
+Tracing: add -DMUNCHKIN_TRACE, munchkin_trace.json is written at exit or with F4
+         (open in chrome://tracing or ui.perfetto.dev)
+
 Windows (using MinGW): 
 gcc -o munchkin.exe munchkin.c -Lc:\MinGW\include\SDL2 -lmingw32 -lSDL2main -lSDL2 -lSDL2_mixer -lSDL2_ttf
 
@@ -43,16 +90,39 @@ gcc -o munchkin.exe munchkin.c -Lc:\MinGW\include\SDL2 -lmingw32 -lSDL2main -lSD
 
 #ifdef _WIN32
 #include <SDL2/SDL.h>
+#ifndef MUNCHKIN_OWN_MIXER
 #include <SDL2/SDL_mixer.h>
+#endif
 #include <SDL2/SDL_ttf.h>
 #endif
 
 #ifndef _WIN32  // nodig?
 #include <SDL2/SDL.h>
+#ifndef MUNCHKIN_OWN_MIXER
 #include <SDL2/SDL_mixer.h>
+#endif
 #include <SDL2/SDL_ttf.h>
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>      // mix_samples()
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>      // asset pack: CreateFileMapping
+#else
+#include <fcntl.h>        // asset pack: mmap
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef MUNCHKIN_EMBED
+#include "munchkin_pak.h"   // munchkin_pak[]: the asset pack, written by --make-embedded
+#endif
+
 /* constants */
 #define VERSION "1.2.5"
 
@@ -76,9 +146,45 @@ gcc -o munchkin.exe munchkin.c -Lc:\MinGW\include\SDL2 -lmingw32 -lSDL2main -lSD
 #define VIDEOPAC_RES_W 200.0      // original console screen resolution width
 #define VIDEOPAC_RES_H 160.0      // original console screen resolution height
                                   // must be float to calculatie factor
+                                  // (also the logical render size, all drawing is in these pixels)
+#define SUBPIXELS 5               // pills move in 1/5 Videopac pixels (as on the old 1000x800 screen)
 #define JOYSTICK_DEAD_RANGE 8000  // dead-range - and + for analog joystick
 
 #define NUM_SOUNDS 20
+#define FIRST_MUSIC 18      // 18 and 19, the intermission music, are streamed (start_music())
+
+#ifdef MUNCHKIN_OWN_MIXER
+/* built-in mixer: the few SDL_mixer calls the game uses, on a plain SDL audio device.
+   Effects are mixed by audio_post_mix(), there are no mixer channels or music */
+#define MIX_MAX_VOLUME 128
+
+typedef struct Mix_Chunk {
+  int allocated;                         // TRUE: abuf is ours
+  Uint8 *abuf;                           // samples in the device format
+  Uint32 alen;                           // in bytes
+  Uint8 volume;
+} Mix_Chunk;
+
+#define Mix_Volume(channel, volume)      ((void)(volume))    // effects_volume is used
+#define Mix_VolumeMusic(volume)          ((void)(volume))
+#define Mix_AllocateChannels(channels)   ((void)(channels))
+#define Mix_HaltChannel(channel)         ((void)(channel))
+#define Mix_HaltMusic()                  ((void)0)
+
+int Mix_OpenAudioDevice(int frequency, Uint16 format, int channels, int chunksize, 
+                        const char *device, int allowed_changes);
+int Mix_QuerySpec(int *frequency, Uint16 *format, int *channels);
+void Mix_SetPostMix(void (*mix_func)(void *udata, Uint8 *stream, int len), void *arg);
+Mix_Chunk * Mix_LoadWAV(const char *file);
+void Mix_FreeChunk(Mix_Chunk *chunk);
+Mix_Chunk * Mix_QuickLoad_RAW(Uint8 *mem, Uint32 len);
+void own_mixer_callback(void *udata, Uint8 *stream, int len);
+
+SDL_AudioDeviceID own_mixer_device;      // 0: not open
+SDL_AudioSpec own_mixer_spec;
+void (*own_mixer_post_mix)(void *udata, Uint8 *stream, int len);
+#endif
+#define NUM_VOICES  8             // mixer channels, play_sound() chooses one
 
 typedef struct horizontal_line_type {     // contatins 8 rows of 9 lines
   char line[NUM_HORI_CELLS + 1];
@@ -120,15 +226,84 @@ ghost_type ghosts[16];    // max 10 in game and 16 in intermission2
 /* global variables */
 int screen_width  = 1000;       // initial factor 5 van Videpac 5x200
 int screen_height = 800;        // initial factor 5 van Videpac 5x160
-int screen_offset_x = 0;        // offset from the left is full_screen (0 when windowed)
-int screen_offset_y = 0;        // offset from the top is full_screen (0 when windowed)
 int factor = 5;                 // resize factor (relative to 200x160 screen resolution)
+                                // only used for window size and font size, SDL scales the rest
+int requested_factor = 0;       // --scale N for the window (0 = largest that fits the desktop)
+int window_width  = 0;          // --window WxH (0 = 200x160 times the factor)
+int window_height = 0;
+int maze_zoom = SUBPIXELS;      // subpixels per maze pixel: SUBPIXELS in game,
+                                //                           1 for the mini-maps in title screen
 int full_screen;                // TRUE/FALSE
+int software_rendering;         // TRUE/FALSE: no GPU, draw in framebuffer, show changed tiles
 
 int use_joystick;
 int num_joysticks;
-int joy_left, joy_right, joy_up, joy_down;
-int last_joystick_action;       // TRUE/FALSE   used in title screen only
+
+/* input: input_watch() sees every event when SDL queues it and puts the keys and joystick
+   as actions, with a time stamp, in a single producer / single consumer ring; input_tick()
+   takes them once per frame. A press shorter than a frame is still in that frame's actions */
+#define ACTION_LEFT        (1 << 0)
+#define ACTION_RIGHT       (1 << 1)
+#define ACTION_UP          (1 << 2)
+#define ACTION_DOWN        (1 << 3)
+#define ACTION_FIRE        (1 << 4)     // 1, Enter, Ctrl, joystick button A/B
+#define ACTION_BACK        (1 << 5)     // Escape, joystick home/menu button
+#define ACTION_FULL_SCREEN (1 << 6)     // key 8
+#define ACTION_REWIND      (1 << 7)     // Backspace, joystick button 2/3: hold in arcade mode
+#define ACTION_SKIP        (1 << 8)     // 1, Left Ctrl: skip intermission (with ACTION_FIRE)
+#define ACTION_QUIT        (1 << 9)     // Escape, joystick home button: quit from intermission
+#define INPUT_EVENTS       256          // power of 2
+
+typedef struct input_event_type {
+  Uint32 down;                           // actions pressed (or key repeat)
+  Uint32 up;                             // actions released
+  Uint64 time;                           // performance counter, when SDL queued the event
+} input_event_type;
+
+input_event_type input_events[INPUT_EVENTS];
+SDL_atomic_t input_event_head;           // written by input_watch() only
+SDL_atomic_t input_event_tail;           // written by input_tick() only
+int input_events_dropped;                // ring was full
+Uint32 input_held;                       // actions down after the last input_tick()
+Uint64 input_press_time;                 // first press taken by the last input_tick(), 0 = none
+Uint32 joystick_directions;              // input_watch() only, to pass only changes
+
+/* idle power: focus lost or minimized stops the game, the sound and the drawing until
+   the window is back (pause_while_inactive() sleeps in SDL_WaitEventTimeout()); the title
+   screen and the intermissions without input for a minute draw only every IDLE_REDRAW
+   frame and sleep until the next one (idle_tick(), wait_for_next_frame()) */
+#define IDLE_TICKS   (60 * 1000)
+#define IDLE_REDRAW  3
+Uint32 last_input_time;                  // SDL_GetTicks() of the last press, input_tick()
+int idle;                                // TRUE: nobody there, title screen or intermission
+int idle_skip;                           // TRUE: idle frame that is not drawn and not waited for
+int window_active = TRUE;                // FALSE: focus lost or minimized (input_watch())
+SDL_atomic_t audio_paused;               // TRUE: audio_post_mix() leaves the buffer silent
+int skip_drawing;                        // TRUE: render_copy() and present_screen() do nothing
+
+/* input latency: with --input-latency the first press taken by a frame is followed to the
+   end of that frame's present (SDL_RenderPresent(), or the window update in software) */
+#define INPUT_LATENCY_SAMPLES 4096       // the last ones are kept
+
+typedef struct input_latency_type {
+  int tick;                              // frame that took the press
+  float queue_ms;                        // press to input_tick()
+  float present_ms;                      // press to present done
+} input_latency_type;
+
+int measure_input_latency;               // TRUE/FALSE
+int use_vsync;                           // TRUE/FALSE: --vsync
+input_latency_type input_latency[INPUT_LATENCY_SAMPLES];
+int input_latency_count;                 // all measured presses
+Uint64 latency_press_time;               // press taken, its frame is not presented yet (0 = none)
+Uint64 latency_tick_time;
+int latency_tick;
+
+/* autopilot: with --autopilot a breadth first search over the maze cells chooses the
+   direction to the nearest pill (or magenta ghost), around the cells next to the ghosts;
+   it gives the same actions as the keys, get_user_input() does the rest */
+int autopilot;                           // TRUE/FALSE
+int autopilot_direction;                 // chosen at the last cell centre, held until the next
 
 int NUM_PILLS;                  // default 12 min 12 max 99
 int NUM_GHOSTS;                 // default 4  min  1 max 10
@@ -167,11 +342,101 @@ int flash_high_score_timer;     // 0..150 frames reverse, timer for flashing hig
                                 //                        at end of every game
 int frame;                      // frame counter
 int start_delay;                // used to delay start screen
+Uint32 game_seed = 1;           // game_rand(): pills and ghosts, part of the game state
+
+/* env API: the game is in the globals above, env_step() loads each game into them, runs
+   one frame and saves it again (game_state_type). Observations, rewards (score points) and
+   done flags go to the caller's buffers, n_envs of each; nothing is allocated per step */
+#define ENV_FRAME_W  200                 // optional frames: palette index per Videopac pixel
+#define ENV_FRAME_H  160
+#define ENV_MAX_GHOSTS 10
+#define ENV_WALL_LEFT  1                 // env_observation_type walls[][] bits
+#define ENV_WALL_RIGHT 2
+#define ENV_WALL_UP    4
+#define ENV_WALL_DOWN  8
+enum { ENV_BLACK, ENV_MAZE_MAGENTA, ENV_MAZE_YELLOW, ENV_MUNCHKIN, ENV_PILL, ENV_POWERPILL,
+       ENV_GHOST = 8 };                  // + ghost colour 1..7 (5 magenta, 7 white)
+
+#define GAME_STATE_MAGIC 0x314b4e4d      // "MNK1"
+
+typedef struct game_state_type {         // everything a game frame changes, no pointers
+  Uint32 magic, size;                    // GAME_STATE_MAGIC and sizeof(game_state_type)
+  pill_type pills[99];
+  ghost_type ghosts[16];
+  int num_pills, num_ghosts;
+  int munchkin_x_factor1, munchkin_y_factor1, munchkin_auto_direction, munchkin_last_direction;
+  int speed, munchkin_animation_frame, munchkin_dying_animation, munchkin_dying;
+  int maze_center_open, maze_completed, maze_completed_animations;
+  int maze_color;
+  int maze_selected, arcade_mode;
+  int last_pill_speed_increased, powerpill_color, powerpill_active_timer;
+  int score, frame, start_delay;
+  Uint32 game_seed;
+  int high_score, high_score_broken, high_score_registration, high_score_character_pos;
+  int flash_high_score_timer;
+  int autopilot_direction;
+  horizontal_line_type horizontal_lines[NUM_HORI_LINES_COL];   // the chars last, 164 bytes:
+  vertical_line_type vertical_lines[NUM_VERT_CELLS];           // no padding, every byte is set
+  char high_score_name[7];
+} game_state_type;
+
+typedef struct env_observation_type {
+  Uint8 walls[NUM_VERT_CELLS][NUM_HORI_CELLS];   // ENV_WALL_* per cell
+  Sint16 munchkin[3];                    // x, y (Videopac pixels), dying
+  Sint16 pills[99][3];                   // x, y, status 0 = eaten, 1 = pill, 2 = powerpill
+  Sint16 ghosts[ENV_MAX_GHOSTS][3];      // x, y, status 1 = normal, 2 = magenta, 3 = eaten, 4 = recharging
+  Sint16 powerpill_active_timer;         // frames the ghosts can still be eaten
+} env_observation_type;
+
+typedef struct env_type {
+  int n_envs;
+  int maze, num_pills, num_ghosts;       // for every game
+  game_state_type * games;
+  env_observation_type * observations;   // caller's buffers
+  int * rewards;                         // score points of the last step: pill 1, powerpill 3, ghost 10
+  Uint8 * dones;                         // caught or maze completed, the next step starts a new game
+  Uint8 * frames;                        // NULL or n_envs x ENV_FRAME_W x ENV_FRAME_H
+} env_type;
+
+/* snapshots: F5 keeps the game in quick_state (one flat game_state_type, a copy of it is a
+   clone of the game), F9 loads it again. --state FILE also writes it to FILE and the first
+   game starts from FILE (tests at a known moment, kiosks after a crash with --checkpoint) */
+char * state_file;                       // NULL: snapshots only in memory
+int resume_from_state_file = TRUE;       // FALSE after the first game
+int checkpoint_seconds;                  // 0: no checkpoints
+game_state_type quick_state;             // F5
+int quick_state_saved;                   // TRUE/FALSE
+
+/* rewind: every arcade game frame goes into a byte ring as the XOR of its game_state_type
+   against the keyframe of that second, run length coded (most bytes do not change, about
+   120..180 bytes per frame, 30 seconds in 110..160 KB). The oldest go when REWIND_FRAMES or REWIND_BYTES is full;
+   while ACTION_REWIND is held rewind_frame() plays them back newest first */
+#define REWIND_FRAMES    (30 * 30)        // 30 seconds
+#define REWIND_KEYFRAME  30               // frames per keyframe (coded against zero)
+#define REWIND_BYTES     (256 * 1024)     // power of 2
+#define REWIND_MAX_ENTRY (sizeof(game_state_type) * 3 / 2 + 1)   // zero and non-zero bytes alternate
+
+typedef struct rewind_entry_type {
+  Uint32 start;                          // in rewind_ring, & (REWIND_BYTES - 1)
+  int size;
+  int keyframe;                          // its keyframe's entry number, itself for a keyframe
+} rewind_entry_type;
+
+Uint8 rewind_ring[REWIND_BYTES];
+rewind_entry_type rewind_entries[REWIND_FRAMES];   // entry number % REWIND_FRAMES
+int rewind_oldest;                       // entry number
+int rewind_count;
+int rewind_bytes_used;
+Uint32 rewind_write;                     // next byte in rewind_ring
+game_state_type rewind_key_state;        // decoded keyframe
+int rewind_key_entry = -1;               // its entry number, -1: none
+int rewinding;                           // TRUE: ACTION_REWIND held this frame
 
 int vol_effects, vol_music;
 Mix_Chunk * sounds[NUM_SOUNDS];
 
 SDL_Joystick *js;
+SDL_GameController *controller;          // joystick 0 when SDL knows its layout, else NULL
 
 
 /* DATA_PREFIX              do not change the order/name/location of images
@@ -367,6 +632,100 @@ SDL_Texture * images_textures[NUM_IMAGES];
 SDL_Window * gWindow = NULL; 
 SDL_Renderer * gRenderer;
 
+/* software rendering: the renderer draws in a 200x160 framebuffer, present_screen()
+   copies only the tiles that differ from last frame to the window */
+#define DIRTY_TILE 8                     // tile size in Videopac pixels (200x160 = 25x20 tiles)
+SDL_Surface * framebuffer;
+SDL_Surface * last_framebuffer;          // what is on the window now
+SDL_Surface * last_window_surface;
+SDL_Rect dirty_rects[(200 / DIRTY_TILE) * (160 / DIRTY_TILE)];
+int full_redraw;                         // TRUE/FALSE: copy the whole frame next time
+
+/* frame capture: present_screen() converts the framebuffer into one of 2 buffers,
+   a writer thread writes them, so a slow disk or pipe does not hold up the game */
+#define CAPTURE_BUFFER_SIZE (32 + 200 * 160 * 3)    // header + RGB24 frame (Y4M frame is smaller)
+int headless;                            // TRUE/FALSE: dummy video and audio driver
+FILE * capture_file;                     // NULL: no capture
+int capture_y4m;                         // TRUE: Y4M video, FALSE: PPM images
+int capture_frames;                      // --frames N: quit after N frames, 0 = no limit
+int captured_frames;
+Uint8 capture_buffers[2][CAPTURE_BUFFER_SIZE];
+int capture_buffer_used[2];              // bytes to write, -1 = end of capture
+int capture_fill;                        // buffer the game fills next
+SDL_Thread * capture_thread;
+SDL_sem * capture_free;                  // buffers the game can fill
+SDL_sem * capture_full;                  // buffers the writer can write
+
+/* golden image test, see run_golden_test() */
+char * golden_dir;                       // NULL: no golden image test
+int golden_record;                       // TRUE: write golden images instead of comparing
+int golden_tolerance = 8;                // allowed difference per colour value
+int golden_failures;
+char golden_scene[40];                   // intermission running for the test ("" = none)
+int golden_frame;                        // frames presented in that intermission
+Uint8 golden_now[200 * 160 * 3];         // RGB24 frame
+Uint8 golden_ref[200 * 160 * 3];         // RGB24 golden image (and diff image)
+
+/* frame time profiler, F3 shows it during the game */
+#define PROF_INPUT    0                  // get_user_input() without handle_munchkin()
+#define PROF_UPDATE   1                  // handle_munchkin(), handle_pills(), handle_ghosts() ...
+#define PROF_RENDER   2                  // draw_maze(), draw_pills(), draw_ghosts() ...
+#define PROF_PRESENT  3                  // present_screen()
+#define PROF_ZONES    4
+#define PROF_HISTORY  128                // frames for the histogram and percentiles
+#define PROF_BUCKETS  12                 // histogram bars of 4 ms
+int profiler_on;                         // TRUE/FALSE
+const char * prof_zone_names[PROF_ZONES] = { "input", "update", "render", "present" };
+Uint64 prof_zone_ticks[PROF_ZONES];      // this frame
+float prof_zone_ms[PROF_ZONES];          // last frame
+float prof_frame_ms[PROF_HISTORY];       // time per frame without the wait for the next frame
+int prof_history_pos;
+int prof_history_frames;
+int prof_missed;                         // frames over the 33 ms budget
+char prof_text[6][40];
+int draw_calls, texture_switches, textures_created;        // this frame
+int prof_draw_calls, prof_texture_switches, prof_textures_created;
+SDL_Texture * last_texture;
+
+/* Chrome trace zones, TRACE_BEGIN(name) ... TRACE_END(name) in the same block.
+   Without -DMUNCHKIN_TRACE they are empty */
+#ifdef MUNCHKIN_TRACE
+#define TRACE_FILE     "munchkin_trace.json"
+#define TRACE_EVENTS   65536             // per thread, the oldest are overwritten
+#define TRACE_THREADS  16
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+typedef struct trace_event_type {
+  const char *name;
+  Uint64 start, end;                     // performance counter
+} trace_event_type;
+
+typedef struct trace_buffer_type {
+  trace_event_type events[TRACE_EVENTS];
+  SDL_atomic_t count;                    // events written, only by the owning thread
+  SDL_threadID thread_id;
+} trace_buffer_type;
+
+trace_buffer_type * trace_buffers[TRACE_THREADS];
+SDL_atomic_t trace_num_buffers;
+THREAD_LOCAL trace_buffer_type * trace_buffer;     // buffer of this thread
+SDL_threadID trace_main_thread;
+Uint64 trace_t0;                         // start of the program
+
+void trace_add(const char *name, Uint64 start);
+void write_trace();
+
+#define TRACE_BEGIN(zone)  Uint64 trace_start_##zone = SDL_GetPerformanceCounter()
+#define TRACE_END(zone)    trace_add(#zone, trace_start_##zone)
+#else
+#define TRACE_BEGIN(zone)
+#define TRACE_END(zone)
+#endif
+
 /* global font variables */
 SDL_Surface * text;    
 SDL_Texture * text_texture;                   
@@ -374,17 +733,217 @@ TTF_Font * font_large;
 TTF_Font * font_small;
 int font_size;
 
+/* text lines rendered earlier, so unchanged text is not rasterized every frame */
+#define NUM_TEXT_CACHE 16
+typedef struct text_cache_type {
+  TTF_Font * font;
+  SDL_Color color;
+  char text_line[40];
+  SDL_Texture * texture;
+  int w, h;              // texture size (window pixels)
+} text_cache_type;
+
+text_cache_type text_cache[NUM_TEXT_CACHE];
+int next_text_cache;           // next entry to replace (round robin)
+
+/* title screen textures, made once by prerender_title_screen() */
+#define MINI_MAP_W 182         // maze size in maze pixels: 9 x (HORI_LINE_SIZE - 2) + 2
+#define MINI_MAP_H 100         //                           7 x (VERT_LINE_SIZE - 2) + 2
+SDL_Texture * mini_map_textures[4][2];   // [maze - 1][0 = yellow, 1 = magenta (selected)]
+SDL_Texture * marquee_texture;           // scrolling instructions, 3 colours in 1 texture
+SDL_Texture * select_game_texture;       // "SELECT GAME", 7 colours in 1 texture
+int title_textures_factor;               // factor the title textures were made for
+
+/* asset pack: images (RGBA8888 or QOI, white already transparent), sounds (in the audio device
+   format) and the font in 1 file. It is mapped in memory and used as it is, so startup
+   does not open 100 small files. Made with --make-pack, without it data/ is used */
+#define PACK_FILE        DATA_PREFIX "munchkin.pak"
+#define PACK_VERSION     2
+#define PACK_MAX_ENTRIES 160                 // room in the index (81 images, 14 sounds, font)
+#define PACK_RAW         0                   // entry encoding: as it is used
+#define PACK_QOI         1                   //                 image in QOI, see qoi_decode()
+#define QOI_MAX_SIZE(w, h) (14 + (w) * (h) * 5 + 8)  // header, worst case pixels, end marker
+
+typedef struct pack_header_type {
+  char magic[4];                         // "MPAK"
+  Uint32 version;
+  Uint32 num_entries;
+  Uint32 audio_frequency;                // audio device format of the sounds
+  Uint32 audio_format;
+  Uint32 audio_channels;
+} pack_header_type;
+
+typedef struct pack_entry_type {
+  char name[64];                         // as in image_names[] / sound_names[], or "O2.ttf"
+  Uint32 offset, size;                   // in bytes from the start of the pack (16 aligned)
+  Uint32 w, h;                           // images only
+  Uint32 encoding;                       // PACK_RAW or PACK_QOI
+} pack_entry_type;
+
+const Uint8 * pack_data;                 // NULL: no pack, load from the files
+size_t pack_size;
+const pack_header_type * pack_header;
+const pack_entry_type * pack_entries;
+int make_pack;                           // TRUE: --make-pack
+int make_embedded;                       // TRUE: --make-embedded
+void * font_data;                        // O2.ttf read once (when not in the pack)
+size_t font_data_size;
+
+/* startup decoding: worker threads load and convert the images and sounds,
+   the main thread only makes the textures and gives the sounds to the mixer */
+#define MAX_ASSET_WORKERS 8
+#define NUM_ASSET_JOBS    (NUM_IMAGES + NUM_SOUNDS)   // job i < NUM_IMAGES is an image, else a sound
+SDL_Thread * asset_workers[MAX_ASSET_WORKERS];
+int num_asset_workers;                   // 0: workers not running, decode on the main thread
+SDL_atomic_t next_asset_job;
+SDL_atomic_t asset_job_done[NUM_ASSET_JOBS];
+SDL_sem * asset_job_finished[NUM_ASSET_JOBS];   // posted when that job is done
+SDL_Surface * decoded_images[NUM_IMAGES];
+Mix_Chunk * decoded_sounds[NUM_SOUNDS];
+
+/* deferred setup: the title screen shows while the audio device opens and the sounds
+   load on a thread (play_sound() is silent until then), joysticks are looked for
+   after the first title frame */
+SDL_Thread * audio_thread;               // NULL: not running (or already joined)
+SDL_sem * audio_device_opened;           // posted for every asset worker after Mix_OpenAudio()
+int audio_device_ok;                     // TRUE/FALSE, set before the posts
+SDL_atomic_t audio_ready;                // TRUE: all sounds loaded, play_sound() plays
+SDL_atomic_t audio_setup_done;           // TRUE: audio thread can be joined
+int joystick_pending;                    // TRUE: setup_joystick() still to do
+
+/* audio latency: --audio-rate and --audio-buffer choose the device buffer, the
+   post-mix callback counts buffers that came late and, with --audio-latency,
+   measures the time from play_sound() to the first mixed samples of that sound */
+int audio_rate = 22050;                  // asked for
+int audio_buffer = 1024;                 // samples per buffer (1024 at 22050 Hz is 46 ms)
+int audio_device_rate;                   // what the device gave
+Uint64 audio_mix_period;                 // performance counter ticks per buffer
+Uint64 last_mix_time;                    // audio thread only
+int measure_audio_latency;               // TRUE/FALSE
+SDL_atomic_t audio_late_buffers;
+SDL_atomic_t mix_silent;                 // TRUE: last mixed buffer was silence
+SDL_atomic_t latency_event_pending;      // TRUE: latency_event_time waits for its samples
+Uint64 latency_event_time;               // written before latency_event_pending is set
+SDL_atomic_t latency_count;              // measured sounds
+Uint64 latency_total_us;                 // audio thread only: 32 bits of microseconds overflow
+SDL_atomic_t latency_average_us;         // latency_total_us / latency_count, for the other threads
+SDL_atomic_t latency_max_us;
+
+/* voices: every sound has a priority; a sound that is not "multiple" has at most 1 voice
+   and restarts on it; when all voices are busy the lowest priority (oldest) is stolen.
+   The walk and ghost sounds loop while they are the ambient sound, set_ambient_sound()
+   only gives an audio command when it changes */
+typedef struct sound_info_type {
+  int priority;                          // 0 (ambient) .. 5
+  int loop;                              // TRUE: loops until stopped
+  int multiple;                          // TRUE: may play on more voices at once (beeps)
+  Uint32 stops;                          // bit (1 << sound) for every sound it stops
+} sound_info_type;
+
+#define STOPS(snd) (1u << (snd))
+sound_info_type sound_info[NUM_SOUNDS] = {
+  {0}, {0}, {0}, {0}, {0}, {0},
+  {2, FALSE, FALSE, 0},                                        //  6 score
+  {1, FALSE, TRUE,  0},                                        //  7 character beep
+  {0}, {0},
+  {3, FALSE, FALSE, STOPS(17) | STOPS(13) | STOPS(16) | STOPS(11)},   // 10 select game
+  {0, TRUE,  FALSE, STOPS(16)},                                // 11 munchkin walk
+  {2, FALSE, FALSE, 0},                                        // 12 eat pill
+  {4, FALSE, FALSE, STOPS(16) | STOPS(11)},                    // 13 maze completed
+  {3, FALSE, FALSE, 0},                                        // 14 eat powerpill
+  {3, FALSE, FALSE, STOPS(11)},                                // 15 ghost eaten
+  {0, TRUE,  FALSE, STOPS(11)},                                // 16 ghosts move
+  {5, FALSE, FALSE, STOPS(16) | STOPS(11)},                    // 17 dying
+  {5, FALSE, FALSE, 0},                                        // 18 intermission 1
+  {5, FALSE, FALSE, 0}                                         // 19 intermission 2
+};
+
+int voice_sound[NUM_VOICES];             // sound on the voice (when busy)
+int voice_started[NUM_VOICES];           // frame, the oldest is stolen first
+SDL_atomic_t voice_busy[NUM_VOICES];     // generation of the sound on it, 0 = free; the audio
+                                         // thread clears it when that sound ends
+int voice_generation;                    // last generation given (game thread)
+int ambient_sound;                       // 11, 16 or 0: loop playing now
+int effects_volume;                      // 0..MIX_MAX_VOLUME
+
+/* audio commands: the game thread puts them in a single producer / single consumer
+   ring and audio_post_mix() takes them in the audio thread, so the game never waits
+   for the audio lock. The time stamp places the command in the next buffer at the
+   same distance as it was given after the last one (constant delay, no jitter) */
+#define AUDIO_COMMANDS 64                // power of 2
+#define AUDIO_PLAY     1
+#define AUDIO_STOP     2
+
+typedef struct audio_command_type {
+  int type;                              // AUDIO_PLAY or AUDIO_STOP
+  int voice;
+  int sound;
+  int generation;                        // of the sound started or stopped
+  int volume;                            // AUDIO_PLAY: 0..MIX_MAX_VOLUME
+  Uint64 time;                           // performance counter
+} audio_command_type;
+
+audio_command_type audio_commands[AUDIO_COMMANDS];
+SDL_atomic_t audio_command_head;         // written by the game thread only
+SDL_atomic_t audio_command_tail;         // written by the audio thread only
+int audio_commands_dropped;              // ring was full (game thread)
+
+typedef struct mix_voice_type {          // audio thread only
+  const Sint16 *samples;                 // NULL: voice is silent
+  int length, position;                  // in samples
+  int loop;                              // TRUE/FALSE
+  int volume;                            // 0..MIX_MAX_VOLUME
+  int generation;
+} mix_voice_type;
+
+mix_voice_type mix_voices[NUM_VOICES];
+
+/* music: the intermission tunes are not loaded at startup, start_music() starts a thread
+   that reads the .wav file (or the pack) and converts it into a small ring; audio_post_mix()
+   mixes from the ring. The thread ends, and frees file and converter, after the last sample */
+#define MUSIC_RING  16384                // samples, power of 2 (0.7 s at 22050 Hz)
+#define MUSIC_CHUNK 1024                 // samples converted at a time
+
+Sint16 music_ring[MUSIC_RING];
+SDL_atomic_t music_write;                // written by the music thread only
+SDL_atomic_t music_read;                 // written by the audio thread only
+SDL_atomic_t music_flush;                // stop_music(): samples before this are skipped
+SDL_atomic_t music_stop;                 // TRUE: music thread ends now
+SDL_Thread * music_thread;               // NULL: no music
+int music_volume;                        // 0..MIX_MAX_VOLUME
+
 #define _________________________a
 #define ___FORWARD_DECLARATIONS__b
 #define _________________________c
 
 /* forward declarations of functions/procedures */
 void toggle_full_screen_mode(int fullscreen);
+void setup_software_rendering();
+void present_screen();
+int tile_changed(int tile_x, int tile_y);
+void start_capture(char *file_name);
+void capture_frame();
+int capture_writer(void *data);
+void stop_capture();
+void wait_for_next_frame(Uint32 last_time);
+void render_copy(SDL_Texture *texture, const SDL_Rect *src, const SDL_Rect *dst);
+void render_copy_f(SDL_Texture *texture, const SDL_Rect *src, const SDL_FRect *dst);
+Uint64 prof_start();
+void prof_stop(int zone, Uint64 start);
+void prof_end_frame(Uint64 frame_start);
+int compare_ms(const void *a, const void *b);
+void draw_profiler();
+int largest_factor(int width, int height);
+void open_fonts();
 void title_screen();
-void display_select_game(int x, int y);
-void display_text_line(int x, int y, char *font_size, char *text_line, SDL_Color *color_text);
+void display_select_game(float x, float y);
+void display_text_line(float x, float y, char *font_size, char *text_line, SDL_Color *color_text);
 void display_instructions(int scroll_x, int scroll_y);
 void switch_active_mini_map(int maze_selected);
+void prerender_title_screen();
+SDL_Texture * render_text_layers(char *font_size, int num_layers, char *text_lines[],
+                                 SDL_Color colors[], int max_width);
+void flush_text_cache();
 void display_active_option_row(int row);
 
 int game(int mode);
@@ -392,8 +951,82 @@ void setup();
 void setup_joystick();
 void start_new_game();
 void load_images();
+int image_used(int i);
+SDL_Surface * load_image_surface(int i);
+void start_asset_workers();
+int asset_worker(void *data);
+void wait_for_asset_job(int job);
+void destroy_asset_semaphores();
+void stop_asset_workers();
+void start_deferred_setup();
+int setup_audio(void *data);
+void finish_deferred_setup(int wait);
+int first_sound_with_name(int i);
+void audio_post_mix(void *udata, Uint8 *stream, int len);
+void print_audio_latency();
+void start_music(int snd);
+void stop_music();
+int music_feeder(void *data);
+SDL_RWops * open_music(int snd, SDL_AudioSpec *spec, Uint32 *length);
+void mix_music(Sint16 *stream, int n);
+TTF_Font * open_font(int size);
+void open_pack();
+const pack_entry_type * find_pack_entry(const char *name);
+int load_image_from_pack(int i);
+Mix_Chunk * load_sound_from_pack(int i);
+void write_pack();
+void write_embedded_pack();
+int add_pack_entry(FILE *f, pack_entry_type *entries, int num_entries, const char *name,
+                   const void *data, Uint32 size, int w, int h, int encoding);
+SDL_Surface * decode_image(int i);
+int qoi_encode(const Uint32 *pixels, int w, int h, Uint8 *out);
+int qoi_decode(const Uint8 *data, Uint32 size, int w, int h, Uint32 *pixels);
 int get_user_input();
+int input_watch(void *data, SDL_Event *event);
+Uint32 key_action(SDL_Keycode key);
+Uint32 controller_action(Uint8 button);
+void push_input_event(Uint32 down, Uint32 up);
+Uint32 input_tick();
+void record_input_latency();
+void print_input_latency();
+void update_window_surface();
+int change_option(int row, int step);
+Uint32 autopilot_actions();
+int autopilot_search(int from_x, int from_y, int target[NUM_VERT_CELLS][NUM_HORI_CELLS],
+                     int avoid[NUM_VERT_CELLS][NUM_HORI_CELLS]);
+int autopilot_step(int cell_x, int cell_y, int direction, int *next_x, int *next_y);
+int autopilot_cell(int x, int y, int *cell_x, int *cell_y);
+void move_munchkin(Uint32 actions);
+int game_rand();
+void seed_random(Uint32 seed);
+void save_game_state(game_state_type *state);
+void load_game_state(const game_state_type *state);
+void save_snapshot();
+void restore_snapshot();
+void write_checkpoint();
+int write_state_file(char *file_name, const game_state_type *state);
+int read_state_file(char *file_name, game_state_type *state);
+void record_rewind_frame();
+void rewind_frame();
+void load_rewind_keyframe(int n);
+void clear_rewind();
+int rewind_encode(const Uint8 *in, int size);
+void rewind_decode(Uint32 start, Uint8 *out, int size);
+void game_tick(Uint32 actions);
+env_type * env_create(int n_envs, int maze, int num_pills, int num_ghosts,
+                      env_observation_type *observations, int *rewards, Uint8 *dones, Uint8 *frames);
+void env_destroy(env_type *env);
+void env_reset(env_type *env, Uint32 seed);
+void env_step(env_type *env, const Uint8 *actions, int n_envs);
+void env_start_game(env_type *env, int i, Uint32 seed);
+void env_observe(env_observation_type *observation);
+void env_draw_frame(Uint8 *pixels);
+void env_fill(Uint8 *pixels, int x, int y, int w, int h, Uint8 colour);
+void run_env_bench(int n_envs);
 void wait_for_no_left_right_event();
+void pause_while_inactive();
+void idle_tick();
+void idle_end();
 void cleanup();
 void handle_screen_resize();
 void setup_maze(int maze_nr);
@@ -419,13 +1052,28 @@ void check_ghosts_hits_munchkin();
 void draw_score_line();
 void flash_high_score_name();
 void print_high_score_char(int character);
-void play_sound(int snd, int chan);
+void play_sound(int snd);
+void set_ambient_sound(int snd);
+void stop_sounds(Uint32 stops);
+int push_audio_command(int type, int voice, int sound, int generation);
+void run_audio_commands(Sint16 *stream, int n, Uint64 previous_mix_time);
+void mix_voices_range(Sint16 *stream, int from, int to);
+void mix_samples(Sint16 *out, const Sint16 *in, int n, int volume);
 
 void intermission1();
 void display_intermission1_text();
 void intermission2();
 void display_intermission2_text();
 
+void run_golden_test();
+void check_rewind_coding();
+void draw_game_scene();
+void golden_key_frame();
+void check_golden_image(char *name);
+int count_differences(const Uint8 *now, const Uint8 *ref, int size, int tolerance);
+int read_ppm(char *file_name, Uint8 *pixels);
+void write_ppm(char *file_name, Uint8 *pixels);
+
 #define __________a
 #define ___MAIN___b
 #define __________c
@@ -434,26 +1082,119 @@ void display_intermission2_text();
    -   MAIN   - 
    ------------ */
 
+#ifndef MUNCHKIN_ENV      // env API: the program that includes munchkin.c has the main()
 int main(int argc, char * argv[])
 {
   int i, mode, quit;
+  char *capture_name;
+  char rest;                    // text after a number: not a number
   printf("Start\n");
 
+#ifdef MUNCHKIN_TRACE
+  trace_t0 = SDL_GetPerformanceCounter();
+  trace_main_thread = SDL_ThreadID();
+#endif
+
   /* Stop any music: */
   Mix_HaltMusic();   
 
   full_screen = FALSE;
+  capture_name = NULL;
   for (i = 1; i < argc; i++) {
       if (strcmp(argv[i], "-fullscreen") == 0 || strcmp(argv[i], "-f") == 0) 
              full_screen = TRUE;
+      if (strcmp(argv[i], "--software") == 0) 
+             software_rendering = TRUE;
+      if (strcmp(argv[i], "--headless") == 0) 
+             headless = TRUE;
+      if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) 
+             capture_name = argv[++i];
+      if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) 
+             capture_frames = atoi(argv[++i]);
+      if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) 
+             golden_dir = argv[++i];
+      if (strcmp(argv[i], "--golden-record") == 0 && i + 1 < argc) {
+             golden_dir = argv[++i];
+             golden_record = TRUE;
+      }
+      if (strcmp(argv[i], "--golden-tolerance") == 0 && i + 1 < argc) 
+             golden_tolerance = atoi(argv[++i]);
+      if (strcmp(argv[i], "--make-pack") == 0) 
+             make_pack = TRUE;
+      if (strcmp(argv[i], "--make-embedded") == 0) {
+             make_pack = TRUE;
+             make_embedded = TRUE;
+      }
+      if (strcmp(argv[i], "--audio-rate") == 0 && i + 1 < argc) 
+             audio_rate = atoi(argv[++i]);
+      if (strcmp(argv[i], "--audio-buffer") == 0 && i + 1 < argc) {
+             audio_buffer = atoi(argv[++i]);
+             if (audio_buffer < 128 || audio_buffer > 8192) {
+                 fprintf(stderr, "Use --audio-buffer N with N from 128 to 8192, for example --audio-buffer 256\n");
+                 exit(1);
+             }
+      }
+      if (strcmp(argv[i], "--audio-latency") == 0) 
+             measure_audio_latency = TRUE;
+      if (strcmp(argv[i], "--vsync") == 0) 
+             use_vsync = TRUE;
+      if (strcmp(argv[i], "--autopilot") == 0) 
+             autopilot = TRUE;
+      if (strcmp(argv[i], "--input-latency") == 0) 
+             measure_input_latency = TRUE;
+      if (strcmp(argv[i], "--state") == 0 && i + 1 < argc) 
+             state_file = argv[++i];
+      if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) 
+             checkpoint_seconds = atoi(argv[++i]);
+      if (strcmp(argv[i], "--env-bench") == 0 && i + 1 < argc) 
+             run_env_bench(atoi(argv[++i]));    // does not return
+      if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+             if (sscanf(argv[++i], "%d%c", &requested_factor, &rest) != 1 || requested_factor <= 0) {
+                 fprintf(stderr, "Use --scale N with N from 1, for example --scale 4\n");
+                 exit(1);
+             }
+      }
+      if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+             if (sscanf(argv[++i], "%dx%d%c", &window_width, &window_height, &rest) != 2 ||
+                 window_width < VIDEOPAC_RES_W || window_height < VIDEOPAC_RES_H) {
+                 fprintf(stderr, "Use --window WxH of at least %dx%d, for example --window 1280x720\n",
+                         (int)VIDEOPAC_RES_W, (int)VIDEOPAC_RES_H);
+                 exit(1);
+             }
+      }
   }  
 
+  if (golden_dir != NULL) headless = TRUE;      // always the 200x160 software framebuffer
+  if (headless == TRUE) {
+      SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+      SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+      software_rendering = TRUE;
+  }
+  if (capture_name != NULL) software_rendering = TRUE;   // frames come from the framebuffer
+
   setup();
+  if (capture_name != NULL) start_capture(capture_name);
 
   /* Call the cleanup function when the program exits */
   atexit(cleanup);
 
-  srand( time(NULL) );
+  if (make_pack == TRUE) {
+      finish_deferred_setup(TRUE);      // all sounds loaded
+      if (audio_device_ok == FALSE) {   // sounds are stored in the device format
+          fprintf(stderr, "--make-pack needs an audio device, no pack written\n");
+          exit(1);
+      }
+      write_pack();
+      if (make_embedded == TRUE) write_embedded_pack();
+      exit(0);
+  }
+
+  seed_random(time(NULL));
+
+  if (golden_dir != NULL) {
+      finish_deferred_setup(TRUE);
+      run_golden_test();    // does not return
+  }
 
   /* Main loop */
   do {  
@@ -465,6 +1206,7 @@ int main(int argc, char * argv[])
   SDL_Quit();
   exit(0);
 }
+#endif
 
 
 
@@ -472,6 +1214,7 @@ int game(int mode)
 {
   int done, quit;
   Uint32 last_time;
+  Uint64 frame_start, t, update_ticks;
    
   frame = 0;
   done = FALSE;
@@ -484,6 +1227,14 @@ int game(int mode)
   wait_for_no_left_right_event();
       
   start_new_game();
+  if (state_file != NULL && resume_from_state_file == TRUE) {    // --state FILE
+      if (read_state_file(state_file, &quick_state) == TRUE) {
+          load_game_state(&quick_state);
+          quick_state_saved = TRUE;
+      }
+  }
+  resume_from_state_file = FALSE;
+  clear_rewind();
 
 
 
@@ -492,7 +1243,10 @@ int game(int mode)
      ------------------ */
   do
   {
+      pause_while_inactive();
       last_time = SDL_GetTicks();
+      frame_start = prof_start();
+      TRACE_BEGIN(frame);
       frame++;
 
       SDL_SetRenderDrawColor( gRenderer, 0x0, 0x0, 0x0, 0x0 );
@@ -502,6 +1256,7 @@ int game(int mode)
       if (munchkin_dying == TRUE && munchkin_dying_animation == 25) {
         if (arcade_mode == TRUE) maze_selected = 1; // reset maze to 1
         start_new_game();
+        clear_rewind();
       }  
 
       /* continue after completion maze */
@@ -524,23 +1279,68 @@ int game(int mode)
         start_new_maze();
       }  
 
+      update_ticks = prof_zone_ticks[PROF_UPDATE];
+      t = prof_start();
       done = get_user_input();   
+      prof_stop(PROF_INPUT, t);
+      prof_zone_ticks[PROF_INPUT] -= prof_zone_ticks[PROF_UPDATE] - update_ticks;  // handle_munchkin()
+
+      if (rewinding == TRUE) {    // Backspace held in arcade mode: a recorded frame back
+          t = prof_start();
+          rewind_frame();
+          prof_stop(PROF_RENDER, t);
+          t = prof_start();
+          present_screen();
+          prof_stop(PROF_PRESENT, t);
+          prof_end_frame(frame_start);
+          TRACE_END(frame);
+          wait_for_next_frame(last_time);
+          continue;               // to the loop condition
+      }
     
+      t = prof_start();
       draw_munchkin();
+      prof_stop(PROF_RENDER, t);
+
+      t = prof_start();
       if (maze_completed == TRUE) handle_maze_completed();
       handle_pills();
+      prof_stop(PROF_UPDATE, t);
+
+      t = prof_start();
       draw_pills();
+      prof_stop(PROF_RENDER, t);
+
+      t = prof_start();
       if (munchkin_dying == FALSE || munchkin_dying_animation == 0) handle_ghosts();
+      prof_stop(PROF_UPDATE, t);
+
+      t = prof_start();
       if (munchkin_dying == FALSE || munchkin_dying_animation <= 3) draw_ghosts();
+      prof_stop(PROF_RENDER, t);
+
+      t = prof_start();
       if (maze_completed == FALSE) check_ghosts_hits_munchkin();
+      prof_stop(PROF_UPDATE, t);
+
+      t = prof_start();
       draw_maze('y');       // in yellow
       draw_score_line(); 
+      prof_stop(PROF_RENDER, t);
+
+      if (profiler_on == TRUE) draw_profiler();
 
-      SDL_RenderPresent(gRenderer);    /* update the screen */
+      t = prof_start();
+      present_screen();    /* update the screen */
+      prof_stop(PROF_PRESENT, t);
+      prof_end_frame(frame_start);
+      TRACE_END(frame);
+
+      if (arcade_mode == TRUE) record_rewind_frame();
+      if (checkpoint_seconds > 0 && frame % (checkpoint_seconds * 30) == 0) write_checkpoint();
 
       /* Pause till next frame: */
-      if (SDL_GetTicks() < last_time + 33)
-          SDL_Delay(last_time + 33 - SDL_GetTicks());
+      wait_for_next_frame(last_time);
     }
   while (!done && !quit);
   
@@ -551,11 +1351,14 @@ int game(int mode)
 
 void setup()
 {
-  int i;
   char title_string[100];
+  TRACE_BEGIN(setup);
 
   /* Init SDL Video: */
-  if (SDL_Init(SDL_INIT_VIDEO) < 0)
+  TRACE_BEGIN(sdl_init);
+  // audio is initialized here, SDL_InitSubSystem() is not thread safe;
+  // the device is opened on the audio setup thread
+  if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0)
     {
       fprintf(stderr,
               "\nError: I could not initialize video!\n"
@@ -563,6 +1366,7 @@ void setup()
               "%s\n\n", SDL_GetError());
       exit(1);
     }
+  SDL_AddEventWatch(input_watch, NULL);     // keys and joystick to actions
 
     /* enable console output in Windows */
     #ifdef _WIN32
@@ -576,63 +1380,30 @@ void setup()
       fprintf(stderr, "Impossible to initialize SDL_TTF: %s\n",SDL_GetError() );
       exit(1);
    }
-   font_size = 60;
-   font_large = TTF_OpenFont("O2.ttf", font_size);
-   if (!font_large)
-      fprintf(stderr, "Cannot load font name O2.ttf large: %s\n", SDL_GetError());
+   // fonts are opened in toggle_full_screen_mode (size depends on factor)
+   TRACE_END(sdl_init);
 
-   font_small = TTF_OpenFont("O2.ttf", font_size/2);
-   if (!font_small)
-      fprintf(stderr, "Cannot load font name O2.ttf small: %s\n", SDL_GetError());
+   if (make_pack == FALSE) open_pack();
 
    high_score = 0; 
    strcpy(high_score_name, "??????");
 
 
-  /* Open display: */
-  toggle_full_screen_mode(full_screen);
-  sprintf(title_string, "MUNCHKIN - version: %s ", VERSION);
-  SDL_SetWindowTitle(gWindow, title_string);
-
-  setup_joystick();
-
-  load_images();
-
+  // images (and later sounds) are decoded by worker threads while the window opens
+  start_asset_workers();
 
-  /* Open sound */
-
-  if (Mix_OpenAudio(22050, AUDIO_S16, 1, 1024) < 0) {
-         fprintf(stderr,
-          "\nWarning: I could not set up audio for 22050 Hz "
-          "16-bit stereo.\n"
-          "The Simple DirectMedia error that occured was:\n"
-          "%s\n\n", SDL_GetError());
-          exit(1);
-  }
-        
-  vol_effects = 5;
-  vol_music = 5;
-  
-  Mix_Volume(-1, vol_effects * (MIX_MAX_VOLUME / 5));
-  Mix_VolumeMusic(vol_music * (MIX_MAX_VOLUME / 5));
+  // audio device and sounds on a thread, the title screen does not wait for them
+  start_deferred_setup();
 
-  Mix_AllocateChannels(32);
 
+  /* Open display: */
+  TRACE_BEGIN(open_display);
+  toggle_full_screen_mode(full_screen);     // also load_images()
+  TRACE_END(open_display);
+  sprintf(title_string, "MUNCHKIN - version: %s ", VERSION);
+  SDL_SetWindowTitle(gWindow, title_string);
 
- /* Load sounds */
-      
- for (i = 0; i < NUM_SOUNDS; i++) {
-    sounds[i] = Mix_LoadWAV(sound_names[i]);
-    if (sounds[i] == NULL)
-      {
-        fprintf(stderr,
-          "\nError: I could not load the sound file:\n"
-          "%s\n"
-          "The Simple DirectMedia error that occured was:\n"
-          "%s\n\n", sound_names[i], SDL_GetError());
-        exit(1);
-      }
-  }  
+  joystick_pending = TRUE;                  // setup_joystick() after the first title frame
 
   NUM_PILLS = 12;                  // default 12 min 12 max 99
   NUM_GHOSTS = 4;                  // default 4  min  1 max 10
@@ -641,6 +1412,7 @@ void setup()
 
   maze_selected = 1;
   arcade_mode = FALSE;
+  TRACE_END(setup);
 }   
 
 
@@ -767,10 +1539,8 @@ void setup_joystick()
 {
   use_joystick = 1;
   num_joysticks = 0;
-  joy_up = 0; joy_down = 0; joy_left = 0; joy_right = 0;
-  last_joystick_action = FALSE;
 
-  if (SDL_Init(SDL_INIT_JOYSTICK) < 0) {
+  if (SDL_Init(SDL_INIT_JOYSTICK | SDL_INIT_GAMECONTROLLER) < 0) {
       fprintf(stderr,
         "\nWarning: I could not initialize joystick.\n"
         "The Simple DirectMedia error that occured was:\n"
@@ -786,8 +1556,10 @@ void setup_joystick()
       }
       else
   {
-    /* Open joystick */
-    js = SDL_JoystickOpen(0);
+    /* Open joystick, as game controller (Xbox/PlayStation layout) when SDL knows it */
+    if (SDL_IsGameController(0)) controller = SDL_GameControllerOpen(0);
+    if (controller != NULL) js = SDL_GameControllerGetJoystick(controller);
+      else js = SDL_JoystickOpen(0);
     if (js == NULL) {
         fprintf(stderr,
           "\nWarning: Could not open joystick 1.\n"
@@ -850,11 +1622,6 @@ void start_new_maze()
   powerpill_color = 1;
   powerpill_active_timer = 0;
 
-  joy_left = 0;
-  joy_right = 0;
-  joy_up = 0;
-  joy_down = 0;
-  
   setup_maze(maze_selected);     // to make sure center down is open
   setup_pills();
   setup_ghosts();
@@ -865,100 +1632,89 @@ void start_new_maze()
 void load_images(void)
 {
   int i;
-  char image_string[200];
-  char temp_string[200];
   SDL_Surface * image;
+  TRACE_BEGIN(load_images);
 
   // hint for pixel scaling
   SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
 
   for (i = 0; i <  NUM_IMAGES; i++) {
 
-    if ((i >= 0 && i <= 4) || i == 6 ||  (i >= 72 && i <= 147))  {
-       strcpy(image_string, image_names[i] );
-       image = SDL_LoadBMP(image_string);
+    if (image_used(i))  {
+       if (load_image_from_pack(i) == TRUE) continue;
+
+       wait_for_asset_job(i);
+       image = decoded_images[i];
+       decoded_images[i] = NULL;
+       if (image == NULL) image = decode_image(i);
+       images_textures[i] = SDL_CreateTextureFromSurface(gRenderer, image);
+       SDL_FreeSurface(image);
+
+   }  // if i >= 0 
+  }  // end for loop
+  TRACE_END(load_images);
+}  
+
+
+int image_used(int i)
+{
+  return((i >= 0 && i <= 4) || i == 6 ||  (i >= 72 && i <= 147));    // others are dummy.bmp
+}
+
+
+SDL_Surface * load_image_surface(int i)
+{
+  SDL_Surface * image, * converted;
 
-    if (image == NULL) {
+  image = SDL_LoadBMP(image_names[i]);
+  if (image == NULL) {
       fprintf(stderr,
         "\nError: I couldn't load a graphics file:\n"
         "%s\n"
         "The Simple DirectMedia error that occured was:\n"
-        "%s\n\n", image_string, SDL_GetError());
+        "%s\n\n", image_names[i], SDL_GetError());
       exit(1);
-    }
+  }
       
-    /* Convert to display format: */
-    image = SDL_ConvertSurfaceFormat(image, SDL_PIXELFORMAT_RGBA8888, 0);
-    if (image == NULL) {
-          fprintf(stderr,
-                  "\nError: I couldn't convert a file to the display format:\n"
-                  "%s\n"
-                  "The Simple DirectMedia error that occured was:\n"
-                  "%s\n\n", image_names[i], SDL_GetError());
-          exit(1);
-     } 
-
-    /* Set transparency: */
-    if (i != 10) {     // do not set transparency for white sprites (not used anymore)
-        if (SDL_SetColorKey(image, (SDL_GetColorKey(image, NULL) | SDL_RLEACCEL),
-                SDL_MapRGB(image -> format,
-                0xFF, 0xFF, 0xFF)) == -1) {
-            fprintf(stderr,
-              "\nError: I could not set the color key for the file:\n"
+  /* Convert to display format: */
+  converted = SDL_ConvertSurfaceFormat(image, SDL_PIXELFORMAT_RGBA8888, 0);
+  SDL_FreeSurface(image);
+  if (converted == NULL) {
+      fprintf(stderr,
+              "\nError: I couldn't convert a file to the display format:\n"
               "%s\n"
               "The Simple DirectMedia error that occured was:\n"
               "%s\n\n", image_names[i], SDL_GetError());
-            exit(1);
-        } 
-
-     }
-
-     images_textures[i] = SDL_CreateTextureFromSurface(gRenderer, image);
-     SDL_FreeSurface(image);
+      exit(1);
+  } 
 
-   }  // if i >= 0 
-  }  // end for loop
-}  
+  /* Set transparency: */
+  if (i != 10) {     // do not set transparency for white sprites (not used anymore)
+      if (SDL_SetColorKey(converted, (SDL_GetColorKey(converted, NULL) | SDL_RLEACCEL),
+              SDL_MapRGB(converted -> format,
+              0xFF, 0xFF, 0xFF)) == -1) {
+          fprintf(stderr,
+            "\nError: I could not set the color key for the file:\n"
+            "%s\n"
+            "The Simple DirectMedia error that occured was:\n"
+            "%s\n\n", image_names[i], SDL_GetError());
+          exit(1);
+      } 
+  }
+  return(converted);
+}
 
 
 int get_user_input()
 {
     SDL_Event event;
-    const Uint8 *keystate = SDL_GetKeyboardState(NULL);
+    Uint32 pressed, actions;
     int rotate_gun = 0;
-    int window_size_changed;
     char title_string[100];
     int i;
-    int munchkin_direction;   //1=left, 2=right, 3=up, 4=down
-    int munchkin_manual_move; //0=no  1=yes
+    Uint64 t;
     //int cell_x, cell_y;
 
-    window_size_changed = 0;
-
-     if ( keystate[SDL_SCANCODE_8] && munchkin_dying != 1) { // toggle full_screen: 8 key
-        window_size_changed = 1;
-        if (full_screen == TRUE) {
-           full_screen = FALSE;
-           factor = 5; 
-        } else { 
-           full_screen = TRUE;
-        }
-     }
-
-     if (window_size_changed == 1) {
-        if (full_screen == TRUE) {
-            toggle_full_screen_mode(full_screen);
-            handle_screen_resize();
-
-        } else {   /* back to windowed */
-             toggle_full_screen_mode(full_screen);
-             handle_screen_resize();
-        ; 
-    }  // if full screen   
-  }         
-     
-
-
   /* Loop through waiting messages and process them */
   
   while (SDL_PollEvent(&event))
@@ -970,12 +1726,19 @@ int get_user_input()
         exit(0);
       break;
 
-      case SDL_KEYDOWN:
-
-        if (event.key.keysym.sym == SDLK_ESCAPE ) {
-            printf("--Escape\n");   // return to instructions
-            start_new_game();           // clear all objects
-            return(1);
+      case SDL_KEYDOWN:      // game keys are actions, see input_watch()
+
+        if (event.key.keysym.sym == SDLK_F3) {
+            profiler_on = !profiler_on;
+            prof_text[0][0] = '\0';       // fresh numbers in the first frame
+        } else if (event.key.keysym.sym == SDLK_F5) {
+            save_snapshot();
+        } else if (event.key.keysym.sym == SDLK_F9) {
+            restore_snapshot();
+#ifdef MUNCHKIN_TRACE
+        } else if (event.key.keysym.sym == SDLK_F4) {
+            write_trace();
+#endif
         } else {
           if ( (event.key.keysym.sym >= 97 && event.key.keysym.sym <= 122)
                  || event.key.keysym.sym == 32 || event.key.keysym.sym == 13) {    // spatie, return
@@ -986,61 +1749,47 @@ int get_user_input()
         }
       break;
 
-      case SDL_JOYBUTTONDOWN:
-          if (  (event.jbutton.button == 0 || event.jbutton.button == 1)
-                && munchkin_dying != 1 )
-               ; //printf("Fire button pressed\n");
-          if (event.type == SDL_JOYBUTTONDOWN  && (event.jbutton.button == 8 || event.jbutton.button == 7)) {  // home/menu button joy
-                 printf("--Escape pressed joystick\n");   // return to instructions
-                 start_new_game();           // clear all objects
-                 return(1);
-          }
-          
-      break;
-
-      case SDL_JOYAXISMOTION:
-        //If joystick 0 has moved
-        if ( event.jaxis.which == 0 ) {
-            //If the X axis changed
-            if ( event.jaxis.axis == 0 ) {
-                //If the X axis is neutral
-                if ( ( event.jaxis.value > -8000 ) && ( event.jaxis.value < 8000 ) ) {
-                     joy_left = 0;
-                     joy_right = 0;
-                } else {
-                    //Adjust the velocity
-                    if ( event.jaxis.value < 0 ) {
-                        joy_left = 1;
-                        joy_right = 0;
-                    } else {
-                        joy_left = 0;
-                        joy_right = 1;
-                    }
-                }
-            }
-            //If the Y axis changed
-            else if ( event.jaxis.axis == 1 ) {
-                //If the Y axis is neutral
-                if ( ( event.jaxis.value > -8000 ) && ( event.jaxis.value < 8000 ) ) {
-                     joy_up = 0;
-                     joy_down = 0;
-                } else {
-                    //Adjust the velocity
-                    if ( event.jaxis.value < 0 ) {
-                     joy_up = 1;
-                     joy_down = 0;
-                    } else {
-                        joy_up = 0;
-                        joy_down = 1;
-                    }
-                }
-            }
-        }   // if event.jaxis.which == 0      
-      break;      
-
     }  // end switch
   }    // end while
 
+  pressed = input_tick();
+  actions = input_held | pressed;      // a tap between two frames still counts
+  if (autopilot == TRUE && munchkin_dying == FALSE)
+      actions = (actions & ~(ACTION_LEFT | ACTION_RIGHT | ACTION_UP | ACTION_DOWN)) | autopilot_actions();
+
+  if (pressed & ACTION_BACK) {
+      printf("--Escape\n");   // return to instructions
+      start_new_game();           // clear all objects
+      return(1);
+  }
+
+  if ((pressed & ACTION_FULL_SCREEN) && munchkin_dying != 1) { // toggle full_screen: 8 key
+      full_screen = !full_screen;
+      toggle_full_screen_mode(full_screen);
+      handle_screen_resize();
+  }
+
+
+   rewinding = (arcade_mode == TRUE && (actions & ACTION_REWIND) && rewind_count > 0);
+   if (rewinding == FALSE) {
+       t = prof_start();
+       move_munchkin(actions);
+       prof_stop(PROF_UPDATE, t);
+   }
+
+
+   /* handle fire key */
+   if ((actions & ACTION_FIRE) && munchkin_dying != 1) {
+       ; // prevent bullets fired to soon after each other
+    }
+ return(0);
+}
+
+
+void move_munchkin(Uint32 actions)     // direction actions to handle_munchkin(), every game frame
+{
+    int munchkin_direction;   //1=left, 2=right, 3=up, 4=down
+    int munchkin_manual_move; //0=no  1=yes
 
    munchkin_direction = 0;
    munchkin_manual_move = 0;
@@ -1049,7 +1798,7 @@ int get_user_input()
 
    if (munchkin_dying == FALSE) {
 
-       if (keystate[SDL_SCANCODE_LEFT] || joy_left == 1) {
+       if (actions & ACTION_LEFT) {
            if (munchkin_auto_direction == UP || munchkin_auto_direction == DOWN) {   
                ;  // // complete current auto move
            } else {
@@ -1059,7 +1808,7 @@ int get_user_input()
                      }    
            }
        }
-       if (keystate[SDL_SCANCODE_RIGHT] || joy_right == 1) { 
+       if (actions & ACTION_RIGHT) { 
            if (munchkin_auto_direction == UP || munchkin_auto_direction == DOWN) {   
                ;  // // complete current auto move
            } else {
@@ -1069,7 +1818,7 @@ int get_user_input()
                      }   
            }    
        }
-       if (keystate[SDL_SCANCODE_UP] || joy_up == 1) { 
+       if (actions & ACTION_UP) { 
            if (munchkin_auto_direction == LEFT || munchkin_auto_direction == RIGHT) {   
                ;  // // complete current auto move
            } else {
@@ -1079,7 +1828,7 @@ int get_user_input()
                    }    
            }    
        }    
-       if (keystate[SDL_SCANCODE_DOWN] || joy_down == 1) { 
+       if (actions & ACTION_DOWN) { 
            if (munchkin_auto_direction == LEFT || munchkin_auto_direction == RIGHT) {   
                ;  // // complete current auto move
            } else {
@@ -1099,43 +1848,250 @@ int get_user_input()
 
        if (maze_completed == FALSE) {   
               handle_munchkin(munchkin_direction, munchkin_manual_move);
-              if (munchkin_manual_move != 0 || munchkin_auto_direction != 0 ) play_sound(11, 1); 
-                    else play_sound(16, 6); 
+              if (munchkin_manual_move != 0 || munchkin_auto_direction != 0 ) set_ambient_sound(11); 
+                    else set_ambient_sound(16); 
        }  
 
     } // dying
+}
 
 
-   /* handle fire key */
-   if ( (keystate[SDL_SCANCODE_LCTRL] || keystate[SDL_SCANCODE_RCTRL])  && munchkin_dying != 1 ) {
-       ; // prevent bullets fired to soon after each other
-    }
- return(0);
+int input_watch(void *data, SDL_Event *event)    // every event, when SDL queues it
+{
+  Uint32 down, up, directions;
+  int axis, value;
+
+  down = 0;
+  up = 0;
+  switch (event->type) {
+    case SDL_KEYDOWN:                  // key repeats too, they move through the options
+      down = key_action(event->key.keysym.sym);
+      break;
+    case SDL_KEYUP:
+      up = key_action(event->key.keysym.sym);
+      break;
+
+    case SDL_JOYBUTTONDOWN:
+    case SDL_JOYBUTTONUP:
+      if (controller != NULL) break;   // SDL_CONTROLLERBUTTON events instead
+      if (event->jbutton.button == 0 || event->jbutton.button == 1) down = ACTION_FIRE;
+      if (event->jbutton.button == 2 || event->jbutton.button == 3) down = ACTION_REWIND;
+      if (event->jbutton.button == 7) down = ACTION_BACK;                 // menu
+      if (event->jbutton.button == 8) down = ACTION_BACK | ACTION_QUIT;  // home
+      if (event->type == SDL_JOYBUTTONUP) {
+          up = down;
+          down = 0;
+      }
+      break;
+
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP:
+      down = controller_action(event->cbutton.button);
+      if (event->type == SDL_CONTROLLERBUTTONUP) {
+          up = down;
+          down = 0;
+      }
+      break;
+
+    case SDL_JOYAXISMOTION:            // X and Y axis of joystick 0, neutral from -8000 to 8000
+    case SDL_CONTROLLERAXISMOTION:     // left stick of the game controller, same numbering
+      if (event->type == SDL_JOYAXISMOTION) {
+          if (controller != NULL || event->jaxis.which != 0 || event->jaxis.axis > 1) break;
+          axis = event->jaxis.axis;
+          value = event->jaxis.value;
+      } else {
+          if (event->caxis.axis > SDL_CONTROLLER_AXIS_LEFTY) break;
+          axis = event->caxis.axis;
+          value = event->caxis.value;
+      }
+      if (axis == 0) {
+          directions = joystick_directions & ~(ACTION_LEFT | ACTION_RIGHT);
+          if (value <= -8000) directions |= ACTION_LEFT;
+          if (value >= 8000)  directions |= ACTION_RIGHT;
+      } else {
+          directions = joystick_directions & ~(ACTION_UP | ACTION_DOWN);
+          if (value <= -8000) directions |= ACTION_UP;
+          if (value >= 8000)  directions |= ACTION_DOWN;
+      }
+      // the stick sends many events while it moves: only the changes
+      down = directions & ~joystick_directions;
+      up = joystick_directions & ~directions;
+      joystick_directions = directions;
+      break;
+
+    case SDL_WINDOWEVENT:              // pause_while_inactive()
+      if (event->window.event == SDL_WINDOWEVENT_FOCUS_LOST || 
+          event->window.event == SDL_WINDOWEVENT_MINIMIZED) window_active = FALSE;
+      if (event->window.event == SDL_WINDOWEVENT_FOCUS_GAINED || 
+          event->window.event == SDL_WINDOWEVENT_RESTORED) window_active = TRUE;
+      break;
+  }
+
+  if (down != 0 || up != 0) push_input_event(down, up);
+  return(1);
+}
+
+
+Uint32 key_action(SDL_Keycode key)
+{
+  switch (key) {
+    case SDLK_LEFT:   return(ACTION_LEFT);
+    case SDLK_RIGHT:  return(ACTION_RIGHT);
+    case SDLK_UP:     return(ACTION_UP);
+    case SDLK_DOWN:   return(ACTION_DOWN);
+    case SDLK_1:
+    case SDLK_LCTRL:  return(ACTION_FIRE | ACTION_SKIP);
+    case SDLK_RETURN:
+    case SDLK_RCTRL:  return(ACTION_FIRE);
+    case SDLK_ESCAPE: return(ACTION_BACK | ACTION_QUIT);
+    case SDLK_8:      return(ACTION_FULL_SCREEN);
+    case SDLK_BACKSPACE: return(ACTION_REWIND);
+  }
+  return(0);
+}
+
+
+Uint32 controller_action(Uint8 button)    // same as the joystick buttons, by name
+{
+  switch (button) {
+    case SDL_CONTROLLER_BUTTON_DPAD_LEFT:  return(ACTION_LEFT);
+    case SDL_CONTROLLER_BUTTON_DPAD_RIGHT: return(ACTION_RIGHT);
+    case SDL_CONTROLLER_BUTTON_DPAD_UP:    return(ACTION_UP);
+    case SDL_CONTROLLER_BUTTON_DPAD_DOWN:  return(ACTION_DOWN);
+    case SDL_CONTROLLER_BUTTON_A:
+    case SDL_CONTROLLER_BUTTON_B:          return(ACTION_FIRE);
+    case SDL_CONTROLLER_BUTTON_X:
+    case SDL_CONTROLLER_BUTTON_Y:          return(ACTION_REWIND);
+    case SDL_CONTROLLER_BUTTON_BACK:
+    case SDL_CONTROLLER_BUTTON_START:      return(ACTION_BACK);
+    case SDL_CONTROLLER_BUTTON_GUIDE:      return(ACTION_BACK | ACTION_QUIT);
+  }
+  return(0);
+}
+
+
+void push_input_event(Uint32 down, Uint32 up)    // thread that pumps the events
+{
+  input_event_type *input_event;
+  int head;
+
+  head = SDL_AtomicGet(&input_event_head);
+  if (head - SDL_AtomicGet(&input_event_tail) == INPUT_EVENTS) {
+      input_events_dropped++;
+      return;
+  }
+  input_event = &input_events[head & (INPUT_EVENTS - 1)];
+  input_event->down = down;
+  input_event->up = up;
+  input_event->time = SDL_GetPerformanceCounter();
+  SDL_MemoryBarrierRelease();           // event is complete before input_tick() sees it
+  SDL_AtomicSet(&input_event_head, head + 1);
+}
+
+
+Uint32 input_tick()      // once per frame: the actions pressed since the last tick
+{
+  input_event_type *input_event;
+  Uint32 pressed;
+  int head, tail;
+
+  head = SDL_AtomicGet(&input_event_head);
+  tail = SDL_AtomicGet(&input_event_tail);
+  SDL_MemoryBarrierAcquire();
+
+  pressed = 0;
+  input_press_time = 0;
+  for (; tail != head; tail++) {
+      input_event = &input_events[tail & (INPUT_EVENTS - 1)];
+      if (input_event->down != 0 && input_press_time == 0) input_press_time = input_event->time;
+      pressed |= input_event->down;
+      input_held = (input_held | input_event->down) & ~input_event->up;
+  }
+  if (pressed != 0) last_input_time = SDL_GetTicks();
+
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicSet(&input_event_tail, tail);
+
+  // follow the first press to the present of this frame
+  if (measure_input_latency == TRUE && input_press_time != 0 && latency_press_time == 0) {
+      latency_press_time = input_press_time;
+      latency_tick_time = SDL_GetPerformanceCounter();
+      latency_tick = frame;
+  }
+  return(pressed);
+}
+
+
+void record_input_latency()      // present of the frame that took the press is done
+{
+  input_latency_type *sample;
+  float to_ms;
+
+  to_ms = 1000.0 / SDL_GetPerformanceFrequency();
+  sample = &input_latency[input_latency_count % INPUT_LATENCY_SAMPLES];
+  sample->tick = latency_tick;
+  sample->queue_ms = (latency_tick_time - latency_press_time) * to_ms;
+  sample->present_ms = (SDL_GetPerformanceCounter() - latency_press_time) * to_ms;
+  input_latency_count++;
+  latency_press_time = 0;
+}
+
+
+void print_input_latency()
+{
+  static float queue[INPUT_LATENCY_SAMPLES], present[INPUT_LATENCY_SAMPLES];
+  int i, n;
+
+  if (measure_input_latency == FALSE) return;
+  n = (input_latency_count < INPUT_LATENCY_SAMPLES) ? input_latency_count : INPUT_LATENCY_SAMPLES;
+  printf("input latency (%s, vsync %s, audio buffer %d): %d presses, %d input events dropped\n",
+         software_rendering ? "software" : "GPU", use_vsync ? "on" : "off", audio_buffer, 
+         input_latency_count, input_events_dropped);
+  if (n == 0) return;
+
+  for (i = 0; i < n; i++) {
+      queue[i] = input_latency[i].queue_ms;
+      present[i] = input_latency[i].present_ms;
+  }
+  qsort(queue, n, sizeof(float), compare_ms);
+  qsort(present, n, sizeof(float), compare_ms);
+  printf("  press to frame    p50 %5.1f  p90 %5.1f  p99 %5.1f  max %5.1f ms\n",
+         queue[n / 2], queue[n * 9 / 10], queue[n * 99 / 100], queue[n - 1]);
+  printf("  press to present  p50 %5.1f  p90 %5.1f  p99 %5.1f  max %5.1f ms\n",
+         present[n / 2], present[n * 9 / 10], present[n * 99 / 100], present[n - 1]);
 }
 
 
+
 void cleanup()
 {
   /* Shut down SDL */
   printf("Exit game, cleaning up\n");
+  finish_deferred_setup(TRUE);
+  print_audio_latency();
+  print_input_latency();
+  if (capture_file != NULL) stop_capture();
+#ifdef MUNCHKIN_TRACE
+  write_trace();
+#endif
+  stop_music();
   Mix_HaltMusic();
   Mix_HaltChannel(-1);
   if (use_joystick == 1) SDL_JoystickClose(js);
   TTF_CloseFont(font_large);
   TTF_CloseFont(font_small);
-  SDL_DestroyWindow( gWindow );
   SDL_DestroyRenderer(gRenderer);
+  if (framebuffer) SDL_FreeSurface(framebuffer);
+  if (last_framebuffer) SDL_FreeSurface(last_framebuffer);
+  SDL_DestroyWindow( gWindow );
   SDL_Quit();
 }
 
 
 void handle_screen_resize()
 {
-  load_images();
-
-  // reset pills 
-  setup_pills();
-
+  // window and images are kept by toggle_full_screen_mode and all positions
+  // are in Videopac pixels, so only wait till key 8 is released
   SDL_Delay(500);
 }
 
@@ -1287,11 +2243,11 @@ void draw_munchkin()
   SDL_Rect rect;         
   int image_num;
 
-  rect.x = munchkin_x_factor1 * factor + screen_offset_x;   // real x position  on screen
-  rect.y = munchkin_y_factor1 * factor + screen_offset_y;   // real y postition on screen
+  rect.x = munchkin_x_factor1;
+  rect.y = munchkin_y_factor1;
 
-  rect.w = 8 * factor;   
-  rect.h = 8 * factor;   
+  rect.w = 8;   
+  rect.h = 8;   
 
   if (maze_completed == FALSE) {
       // determine which image to display
@@ -1374,7 +2330,7 @@ void draw_munchkin()
 
   if (munchkin_dying == FALSE || munchkin_dying_animation < 8)
     //SDL_BlitSurface(images[image_num], &src_rect, screen, &rect);
-    SDL_RenderCopy(gRenderer, images_textures[image_num],  NULL, &rect);
+    render_copy(images_textures[image_num],  NULL, &rect);
 
 
 
@@ -1412,7 +2368,7 @@ void draw_munchkin()
   text_position.h = text->h / 2;
 
   //SDL_BlitSurface(text, NULL , screen, &text_position);
-  SDL_RenderCopy(gRenderer, text_texture,  NULL, &text_position);
+  render_copy(text_texture,  NULL, &text_position);
 
   SDL_FreeSurface(text);
   SDL_DestroyTexture(text_texture);
@@ -1432,7 +2388,7 @@ void draw_munchkin()
   text_position.h = (*text).h / 2;    // haal op van surface
 
   //SDL_BlitSurface(text, NULL , screen, &text_position);
-  SDL_RenderCopy(gRenderer, text_texture,  NULL, &text_position);  
+  render_copy(text_texture,  NULL, &text_position);  
 
   SDL_FreeSurface(text);
   SDL_DestroyTexture(text_texture);
@@ -1443,10 +2399,13 @@ void draw_munchkin()
 void draw_maze()       //maze color: y=yellow, m=magenta
 {
   int i,j;
-  SDL_Rect rect;         // image destination   rectangle
+  SDL_FRect rect;        // image destination   rectangle
+  float zoom;            // 1.0 in game, 0.2 for the mini-maps
   char text_hori_line[NUM_HORI_CELLS + 1];        // + 1 for end of string
   char text_vert_line[NUM_VERT_LINES_ROW + 1];    // + 1 for end of string
 
+  zoom = maze_zoom / (float)SUBPIXELS;
+
   // change maze center opening (skip first time and ignore for intermission maze)
   
   if (maze_selected <= 4) {
@@ -1485,24 +2444,25 @@ void draw_maze()       //maze color: y=yellow, m=magenta
 
   }  // maze_selected <= 4
 
+  if (skip_drawing == TRUE) return;      // only the centre rotation (env API, idle frames)
 
   // Draw horizontal lines maze
   if (1 != 1)  {  //(munchkin_auto_direction >= 1 || munchkin_last_direction != 0) { // invisible
                   // if you want to add invisible mazes later
     ;
   } else {
-      rect.w = HORI_LINE_SIZE * factor;   
-      rect.h = 2 * factor;   
+      rect.w = HORI_LINE_SIZE * zoom;   
+      rect.h = 2 * zoom;   
 
       for (j = 0; j < NUM_HORI_LINES_COL; j++)
       {  
         for (i = 0; i < NUM_HORI_CELLS ; i++)  
         {
           if (horizontal_lines[j].line[i] == 'x') {
-            rect.x = (MAZE_OFFSET_X + i*(HORI_LINE_SIZE-2)) * factor + screen_offset_x;
-            rect.y = (MAZE_OFFSET_Y + j*(VERT_LINE_SIZE-2)) * factor + screen_offset_y;
-            if (maze_color == 'm') SDL_RenderCopy(gRenderer, images_textures[0],  NULL, &rect);
-            else                   SDL_RenderCopy(gRenderer, images_textures[77], NULL, &rect);
+            rect.x = (MAZE_OFFSET_X + i*(HORI_LINE_SIZE-2)) * zoom;
+            rect.y = (MAZE_OFFSET_Y + j*(VERT_LINE_SIZE-2)) * zoom;
+            if (maze_color == 'm') render_copy_f(images_textures[0],  NULL, &rect);
+            else                   render_copy_f(images_textures[77], NULL, &rect);
 
           }
         }
@@ -1510,18 +2470,18 @@ void draw_maze()       //maze color: y=yellow, m=magenta
 
       // Draw vertical lines maze
 
-      rect.w = 2 * factor;   
-      rect.h = VERT_LINE_SIZE * factor;  
+      rect.w = 2 * zoom;   
+      rect.h = VERT_LINE_SIZE * zoom;  
 
       for (j = 0; j < NUM_VERT_CELLS; j++) 
       {
         for (i = 0; i < NUM_VERT_LINES_ROW ; i++)  
         {
           if (vertical_lines[j].line[i] == '|') {
-            rect.x = (MAZE_OFFSET_X + i*(HORI_LINE_SIZE-2)) * factor + screen_offset_x;                           
-            rect.y = (MAZE_OFFSET_Y + j*(VERT_LINE_SIZE-2)) * factor + screen_offset_y;    
-            if (maze_color == 'm') SDL_RenderCopy(gRenderer, images_textures[1],  NULL, &rect);
-            else                   SDL_RenderCopy(gRenderer, images_textures[78], NULL, &rect);
+            rect.x = (MAZE_OFFSET_X + i*(HORI_LINE_SIZE-2)) * zoom;                           
+            rect.y = (MAZE_OFFSET_Y + j*(VERT_LINE_SIZE-2)) * zoom;    
+            if (maze_color == 'm') render_copy_f(images_textures[1],  NULL, &rect);
+            else                   render_copy_f(images_textures[78], NULL, &rect);
           }  
         }
       }
@@ -1551,85 +2511,85 @@ void setup_pills()
 
   // top-left
   if (NUM_PILLS >= 1) {
-     pills[0].x = (MAZE_OFFSET_X  + 9 + 0*20) * factor + screen_offset_x;
-     pills[0].y = (MAZE_OFFSET_Y + 7 + 0*14) * factor  + screen_offset_y;
+     pills[0].x = (MAZE_OFFSET_X  + 9 + 0*20) * maze_zoom;
+     pills[0].y = (MAZE_OFFSET_Y + 7 + 0*14) * maze_zoom;
      pills[0].direction = 4;                
      pills[0].status = 2;        // powerpill
   }   
   if (NUM_PILLS >= 2) {
-     pills[1].x = (MAZE_OFFSET_X  + 9 + 1*20) * factor + screen_offset_x;
-     pills[1].y = (MAZE_OFFSET_Y + 7 + 0*14) * factor  + screen_offset_y;
+     pills[1].x = (MAZE_OFFSET_X  + 9 + 1*20) * maze_zoom;
+     pills[1].y = (MAZE_OFFSET_Y + 7 + 0*14) * maze_zoom;
      pills[1].direction = 1;                
      pills[1].status = 1;     
   }   
   if (NUM_PILLS >= 3) {
-     pills[2].x = (MAZE_OFFSET_X  + 9 + 0*20) * factor + screen_offset_x;
-     pills[2].y = (MAZE_OFFSET_Y + 7 + 1*14) * factor  + screen_offset_y;
+     pills[2].x = (MAZE_OFFSET_X  + 9 + 0*20) * maze_zoom;
+     pills[2].y = (MAZE_OFFSET_Y + 7 + 1*14) * maze_zoom;
      pills[2].direction = 2;                
      pills[2].status = 1;     
   }   
   // top-right
   if (NUM_PILLS >= 4) {
-     pills[3].x = (MAZE_OFFSET_X  + 9 + 7*20) * factor + screen_offset_x;
-     pills[3].y = (MAZE_OFFSET_Y + 7 + 0*14) * factor  + screen_offset_y;
+     pills[3].x = (MAZE_OFFSET_X  + 9 + 7*20) * maze_zoom;
+     pills[3].y = (MAZE_OFFSET_Y + 7 + 0*14) * maze_zoom;
      pills[3].direction = 1;                
      pills[3].status = 1;     
   }   
   if (NUM_PILLS >= 5) {
-     pills[4].x = (MAZE_OFFSET_X  + 9 + 8*20) * factor + screen_offset_x;
-     pills[4].y = (MAZE_OFFSET_Y + 7 + 0*14) * factor  + screen_offset_y;
+     pills[4].x = (MAZE_OFFSET_X  + 9 + 8*20) * maze_zoom;
+     pills[4].y = (MAZE_OFFSET_Y + 7 + 0*14) * maze_zoom;
      pills[4].direction = 4;                
      pills[4].status = 2;        // powerpill
   }   
   if (NUM_PILLS >= 6) {
-     pills[5].x = (MAZE_OFFSET_X  + 9 + 8*20) * factor + screen_offset_x;
-     pills[5].y = (MAZE_OFFSET_Y + 7 + 1*14) * factor  + screen_offset_y;
+     pills[5].x = (MAZE_OFFSET_X  + 9 + 8*20) * maze_zoom;
+     pills[5].y = (MAZE_OFFSET_Y + 7 + 1*14) * maze_zoom;
      pills[5].direction = 1;                
      pills[5].status = 1;     
   }   
   // bottom-left
   if (NUM_PILLS >= 7) {
-     pills[6].x = (MAZE_OFFSET_X  + 9 + 0*20) * factor + screen_offset_x;
-     pills[6].y = (MAZE_OFFSET_Y + 7 + 5*14) * factor  + screen_offset_y;
+     pills[6].x = (MAZE_OFFSET_X  + 9 + 0*20) * maze_zoom;
+     pills[6].y = (MAZE_OFFSET_Y + 7 + 5*14) * maze_zoom;
      pills[6].direction = 2;                
      pills[6].status = 1;     
   }   
   if (NUM_PILLS >= 8) {
-     pills[7].x = (MAZE_OFFSET_X  + 9 + 0*20) * factor + screen_offset_x;
-     pills[7].y = (MAZE_OFFSET_Y + 7 + 6*14) * factor  + screen_offset_y;
+     pills[7].x = (MAZE_OFFSET_X  + 9 + 0*20) * maze_zoom;
+     pills[7].y = (MAZE_OFFSET_Y + 7 + 6*14) * maze_zoom;
      pills[7].direction = 3;                
      pills[7].status = 2;       // powerpill
   }   
   if (NUM_PILLS >= 9) {
-     pills[8].x = (MAZE_OFFSET_X  + 9 + 1*20) * factor + screen_offset_x;
-     pills[8].y = (MAZE_OFFSET_Y + 7 + 6*14) * factor  + screen_offset_y;
+     pills[8].x = (MAZE_OFFSET_X  + 9 + 1*20) * maze_zoom;
+     pills[8].y = (MAZE_OFFSET_Y + 7 + 6*14) * maze_zoom;
      pills[8].direction = 2;                
      pills[8].status = 1;     
   }   
   // bottom-right
   if (NUM_PILLS >= 10) {
-     pills[9].x = (MAZE_OFFSET_X  + 9 + 8*20) * factor + screen_offset_x;
-     pills[9].y = (MAZE_OFFSET_Y + 7 + 5*14) * factor  + screen_offset_y;
+     pills[9].x = (MAZE_OFFSET_X  + 9 + 8*20) * maze_zoom;
+     pills[9].y = (MAZE_OFFSET_Y + 7 + 5*14) * maze_zoom;
      pills[9].direction = 1;                
      pills[9].status = 1;     
   }   
   if (NUM_PILLS >= 11) {
-     pills[10].x = (MAZE_OFFSET_X  + 9 + 7*20) * factor + screen_offset_x;
-     pills[10].y = (MAZE_OFFSET_Y + 7 + 6*14) *  factor + screen_offset_y;
+     pills[10].x = (MAZE_OFFSET_X  + 9 + 7*20) * maze_zoom;
+     pills[10].y = (MAZE_OFFSET_Y + 7 + 6*14) * maze_zoom;
      pills[10].direction = 1;                
      pills[10].status = 1;     
   }   
   if (NUM_PILLS >= 12) {
-     pills[11].x = (MAZE_OFFSET_X  + 9 + 8*20) * factor + screen_offset_x;
-     pills[11].y = (MAZE_OFFSET_Y + 7 + 6*14) * factor  + screen_offset_y;
+     pills[11].x = (MAZE_OFFSET_X  + 9 + 8*20) * maze_zoom;
+     pills[11].y = (MAZE_OFFSET_Y + 7 + 6*14) * maze_zoom;
      pills[11].direction = 3;                
      pills[11].status = 2;       // powerpill
   }   
 
   if (NUM_PILLS >= 13) {  // spread the rest of the pills random across to entire maze 
     for (i = 12; i < NUM_PILLS; i++) {
-      pills[i].x = (MAZE_OFFSET_X  + 9 + ( rand()%8 ) *20) * factor + screen_offset_x;  //random cell x between 0 and 8
-      pills[i].y = (MAZE_OFFSET_Y + 7 + ( rand()%6 ) *14) * factor;  //random cell x between 0 and 8
+      pills[i].x = (MAZE_OFFSET_X  + 9 + ( game_rand()%8 ) *20) * maze_zoom;  //random cell x between 0 and 8
+      pills[i].y = (MAZE_OFFSET_Y + 7 + ( game_rand()%6 ) *14) * maze_zoom;  //random cell x between 0 and 8
       pills[i].status = 1; 
       pills[i].direction = 2;    // must have value for choose_pill_direction
       choose_pill_direction(i);
@@ -1661,11 +2621,11 @@ void handle_pills()
   if (active_pills >= 2 && active_pills < NUM_PILLS/2) {
      for (i = 0; i < NUM_PILLS; i++) {  // search active pill
         if (pills[i].status != 0) {     
-               cell_nr_x = ( ((pills[i].x - screen_offset_x)/ factor) - (9 + MAZE_OFFSET_X) ) / (HORI_LINE_SIZE - 2);  
-               cell_nr_y = ( ((pills[i].y - screen_offset_y)/ factor) - (7 + MAZE_OFFSET_Y) ) / (VERT_LINE_SIZE - 2);  
+               cell_nr_x = ( (pills[i].x / maze_zoom) - (9 + MAZE_OFFSET_X) ) / (HORI_LINE_SIZE - 2);  
+               cell_nr_y = ( (pills[i].y / maze_zoom) - (7 + MAZE_OFFSET_Y) ) / (VERT_LINE_SIZE - 2);  
 
-               cell_x_pill = (MAZE_OFFSET_X  + 9 + cell_nr_x * 20) * factor + screen_offset_x;
-               cell_y_pill = (MAZE_OFFSET_Y  + 7 + cell_nr_y * 14) * factor + screen_offset_y;
+               cell_x_pill = (MAZE_OFFSET_X  + 9 + cell_nr_x * 20) * maze_zoom;
+               cell_y_pill = (MAZE_OFFSET_Y  + 7 + cell_nr_y * 14) * maze_zoom;
 
                if (cell_x_pill == pills[i].x && cell_y_pill == pills[i].y) { // pill exactly in middle of cell
                     pills[i].speed = 2; //(int)round(factor/5.0 * 2);
@@ -1681,15 +2641,15 @@ void handle_pills()
         if (pills[i].status != 0) {     
             if (last_pill_speed_increased == 0) {  // increase only once
  
-               cell_nr_x = ( ((pills[i].x - screen_offset_x) / factor) - (9 + MAZE_OFFSET_X) ) / (HORI_LINE_SIZE - 2);  
-               cell_nr_y = ( ((pills[i].y - screen_offset_y) / factor) - (7 + MAZE_OFFSET_Y) ) / (VERT_LINE_SIZE - 2);  
+               cell_nr_x = ( (pills[i].x / maze_zoom) - (9 + MAZE_OFFSET_X) ) / (HORI_LINE_SIZE - 2);  
+               cell_nr_y = ( (pills[i].y / maze_zoom) - (7 + MAZE_OFFSET_Y) ) / (VERT_LINE_SIZE - 2);  
 
-               cell_x_pill = (MAZE_OFFSET_X + 9 + cell_nr_x * 20) * factor + screen_offset_x;
-               cell_y_pill = (MAZE_OFFSET_Y + 7 + cell_nr_y * 14) * factor + screen_offset_y;
+               cell_x_pill = (MAZE_OFFSET_X + 9 + cell_nr_x * 20) * maze_zoom;
+               cell_y_pill = (MAZE_OFFSET_Y + 7 + cell_nr_y * 14) * maze_zoom;
 
                if (cell_x_pill == pills[i].x && cell_y_pill == pills[i].y) { // pill exactly in middle of cell
                     //printf("One pill left, speed increased!\n");
-                    pills[i].speed = factor;  //5; //speed;             // speed same as munchkin
+                    pills[i].speed = maze_zoom;  // speed same as munchkin (1 pixel)
                     last_pill_speed_increased = 1;
                }
             }      // increase once
@@ -1713,11 +2673,11 @@ void handle_pills()
 
                case LEFT:    
                     pills[i].x = pills[i].x - pills[i].speed;
-                    if ( ((pills[i].x - screen_offset_x) / factor) < (MAZE_OFFSET_X - 7)) pills[i].x = (187 + MAZE_OFFSET_X) * factor + screen_offset_x ;  // wrap screen left
+                    if ( (pills[i].x / maze_zoom) < (MAZE_OFFSET_X - 7)) pills[i].x = (187 + MAZE_OFFSET_X) * maze_zoom;  // wrap screen left
                   break;
                case RIGHT:    
                     pills[i].x = pills[i].x + pills[i].speed;
-                    if ( ((pills[i].x  - screen_offset_x) / factor ) > (187 + MAZE_OFFSET_X) ) pills[i].x = (MAZE_OFFSET_X - 7) * factor + screen_offset_x;  // wrap screen left
+                    if ( (pills[i].x / maze_zoom) > (187 + MAZE_OFFSET_X) ) pills[i].x = (MAZE_OFFSET_X - 7) * maze_zoom;  // wrap screen left
                   break;
                case UP:   
                     pills[i].y = pills[i].y - pills[i].speed;
@@ -1729,8 +2689,8 @@ void handle_pills()
 
             } else {   // pill_eaten
                  if (munchkin_dying == FALSE) {
-                   if (pills[i].status == 1) play_sound(12,2);
-                       else play_sound(14,4);
+                   if (pills[i].status == 1) play_sound(12);
+                       else play_sound(14);
                  }    
                  /* increase score and change ghost status if powerpill */
                  if (pills[i].status == 1) score++;
@@ -1767,7 +2727,7 @@ void handle_pills()
          printf("Maze completed\n");
          maze_completed = TRUE;
          maze_completed_animations = 75;  // +/-  3 seconds
-         play_sound(13, 3);
+         play_sound(13);
     }
 
 }
@@ -1779,18 +2739,18 @@ int check_pill_eaten(int i)
   int a_x, a_y, a_xr, a_yb;       // top-left and bottom-right pill
   int b_x, b_y, b_xr, b_yb;       // top-left and bottom-right munchkin
 
-  a_xr = (pills[i].x + 3 * factor);   // width  factor pixel
-  a_yb = (pills[i].y + 2 * factor);   // height factor pixel
+  a_xr = (pills[i].x + 3 * maze_zoom);   // width  in subpixels
+  a_yb = (pills[i].y + 2 * maze_zoom);   // height in subpixels
   a_x  = pills[i].x;
   a_y  = pills[i].y;
  
   // make munchkin dection area smaller to give the impression that 
   // the pill is really eaten (ie pill detecten in center of munchkin)
 
-  b_xr = (munchkin_x_factor1 * factor + screen_offset_x) + 4 * factor; // width factor pixel
-  b_yb = (munchkin_y_factor1 * factor + screen_offset_y) + 4 * factor;    // height factor pixel
-  b_x  = (munchkin_x_factor1 * factor + screen_offset_x) + 2 * factor;
-  b_y  = (munchkin_y_factor1 * factor + screen_offset_y) + 2 * factor;
+  b_xr = (munchkin_x_factor1 + 4) * maze_zoom;    // width in subpixels
+  b_yb = (munchkin_y_factor1 + 4) * maze_zoom;    // height in subpixels
+  b_x  = (munchkin_x_factor1 + 2) * maze_zoom;
+  b_y  = (munchkin_y_factor1 + 2) * maze_zoom;
 
   /* check overlap  */
   if (b_xr  > a_x   &&
@@ -1812,11 +2772,11 @@ void choose_pill_direction (int i)
   int found;
 
   
-  cell_nr_x = ( ((pills[i].x - screen_offset_x) / factor) - (9 + MAZE_OFFSET_X) ) / (HORI_LINE_SIZE - 2);  
-  cell_nr_y = ( ((pills[i].y - screen_offset_y) / factor) - (7 + MAZE_OFFSET_Y) ) / (VERT_LINE_SIZE - 2);  
+  cell_nr_x = ( (pills[i].x / maze_zoom) - (9 + MAZE_OFFSET_X) ) / (HORI_LINE_SIZE - 2);  
+  cell_nr_y = ( (pills[i].y / maze_zoom) - (7 + MAZE_OFFSET_Y) ) / (VERT_LINE_SIZE - 2);  
 
-  cell_x_pill = (MAZE_OFFSET_X  + 9 + cell_nr_x * 20) * factor + screen_offset_x;
-  cell_y_pill = (MAZE_OFFSET_Y  + 7 + cell_nr_y * 14) * factor + screen_offset_y;
+  cell_x_pill = (MAZE_OFFSET_X  + 9 + cell_nr_x * 20) * maze_zoom;
+  cell_y_pill = (MAZE_OFFSET_Y  + 7 + cell_nr_y * 14) * maze_zoom;
 
   //printf("-- cell_xy_pill: %d - %d  pill_xy: %d - %d \n", cell_x_pill, cell_y_pill, pills[i].x, pills[i].y);
 
@@ -1839,13 +2799,13 @@ void choose_pill_direction (int i)
        case LEFT:  
           // continue left (70% chance, else go up or down)
           //    if not, go right back (return)
-          if (left_open == 1 && (up_open == 1 || down_open == 1) && ((rand()%10 >= 3) )) {
+          if (left_open == 1 && (up_open == 1 || down_open == 1) && ((game_rand()%10 >= 3) )) {
              pills[i].direction = LEFT;
           } else {
                    if (up_open == 1 || down_open == 1 ) {
                       found = 0;
                       while (found == 0) {  // go up or down, if possible
-                          if (rand()%2 == 0 && up_open == 1) {
+                          if (game_rand()%2 == 0 && up_open == 1) {
                               found = 1;
                               pills[i].direction = UP;
                           } else { 
@@ -1867,13 +2827,13 @@ void choose_pill_direction (int i)
       case RIGHT: 
           // continue right (70% chance, else go up or down)
           //    if not, go left back (return)
-          if (right_open == 1 && (up_open == 1 || down_open == 1) && ((rand()%10 >= 3) )) {
+          if (right_open == 1 && (up_open == 1 || down_open == 1) && ((game_rand()%10 >= 3) )) {
              pills[i].direction = RIGHT;
           } else {
                    if (up_open == 1 || down_open == 1 ) {
                       found = 0;
                       while (found == 0) {  // go up or down, if possible
-                          if (rand()%2 == 0 && up_open == 1) {
+                          if (game_rand()%2 == 0 && up_open == 1) {
                               found = 1;
                               pills[i].direction = UP;
                           } else { 
@@ -1895,13 +2855,13 @@ void choose_pill_direction (int i)
       case UP: 
           // continue up (70% chance, else go left or right)
           //    if not, go right down (return)
-          if (up_open == 1 && (left_open == 1 || right_open == 1) && ((rand()%10 >= 3) )) {
+          if (up_open == 1 && (left_open == 1 || right_open == 1) && ((game_rand()%10 >= 3) )) {
              pills[i].direction = UP;
           } else {
                    if (left_open == 1 || right_open == 1 ) {
                       found = 0;
                       while (found == 0) {  // go left or right, if possible
-                          if (rand()%2 == 0 && left_open == 1) {
+                          if (game_rand()%2 == 0 && left_open == 1) {
                               found = 1;
                               pills[i].direction = LEFT;
                           } else { 
@@ -1923,13 +2883,13 @@ void choose_pill_direction (int i)
       case DOWN: 
           // continue down (70% chance, else go left or right)
           //    if not, go right up (return)
-          if (down_open == 1 && (left_open == 1 || right_open == 1) && ((rand()%10 >= 3) )) {
+          if (down_open == 1 && (left_open == 1 || right_open == 1) && ((game_rand()%10 >= 3) )) {
              pills[i].direction = DOWN;
           } else {
                    if (left_open == 1 || right_open == 1 ) {
                       found = 0;
                       while (found == 0) {  // go left or right, if possible
-                          if (rand()%2 == 0 && left_open == 1) {
+                          if (game_rand()%2 == 0 && left_open == 1) {
                               found = 1;
                               pills[i].direction = LEFT;
                           } else { 
@@ -1957,33 +2917,34 @@ void choose_pill_direction (int i)
 void draw_pills()
 {
   int i;
-  SDL_Rect rect;     
+  SDL_FRect rect;     
 
   // determine next powerpill color
   if (frame % 20 == 0) powerpill_color++;
   if (powerpill_color == 5) powerpill_color = 1;  // wrap 
+  if (skip_drawing == TRUE) return;
 
   for (i = 0; i < NUM_PILLS; i++)
   {
     if (pills[i].status != 0) {
 
-      rect.x = pills[i].x;
-      rect.y = pills[i].y;
-      rect.w = 3 * factor;
-      rect.h = 2 * factor; 
+      rect.x = pills[i].x / (float)SUBPIXELS;
+      rect.y = pills[i].y / (float)SUBPIXELS;
+      rect.w = 3 * maze_zoom / (float)SUBPIXELS;
+      rect.h = 2 * maze_zoom / (float)SUBPIXELS; 
       
       if (pills[i].status == 1) {
-           SDL_RenderCopy(gRenderer, images_textures[74],  NULL, &rect);
+           render_copy_f(images_textures[74],  NULL, &rect);
       } else {
            if (frame % 20 == 0 ) {   // flash pill
-              rect.w = 6 * factor;       // factor pixel
-              rect.h = 5 * factor;       // factor pixel
+              rect.w = 6 * maze_zoom / (float)SUBPIXELS;
+              rect.h = 5 * maze_zoom / (float)SUBPIXELS;
 
-              rect.x = pills[i].x - (1 * factor);
-              rect.y = pills[i].y - (1 * factor);
-              SDL_RenderCopy(gRenderer, images_textures[82 + powerpill_color],  NULL, &rect);  // powerpill flash    
+              rect.x = (pills[i].x - (1 * maze_zoom)) / (float)SUBPIXELS;
+              rect.y = (pills[i].y - (1 * maze_zoom)) / (float)SUBPIXELS;
+              render_copy_f(images_textures[82 + powerpill_color],  NULL, &rect);  // powerpill flash    
            } else {
-           SDL_RenderCopy(gRenderer, images_textures[78 + powerpill_color],  NULL, &rect);  // powerpill 
+           render_copy_f(images_textures[78 + powerpill_color],  NULL, &rect);  // powerpill 
            }
       }
     }   // if pill alive
@@ -2017,9 +2978,9 @@ void check_ghosts_hits_munchkin()
                      //printf("%d - DEADLY COLLISION!\n", frame);
                      munchkin_dying = TRUE;
                      munchkin_dying_animation = 1;
-                     play_sound(17, 7); 
+                     play_sound(17); 
                } else {   // ghost has status 2 and can be eaten
-                     play_sound(15, 5); 
+                     play_sound(15); 
                      ghosts[i].status = 3;
                      score = score + 10;
                      if (score > high_score) {
@@ -2238,13 +3199,13 @@ void choose_ghost_direction (int i)
           case LEFT:  
              // continue left (50% chance, else go up or down)
              //    if not, go right back (return)
-             if (left_open == 1 && (up_open == 1 || down_open == 1) && ((rand()%10 >= 5) )) {
+             if (left_open == 1 && (up_open == 1 || down_open == 1) && ((game_rand()%10 >= 5) )) {
                 ghosts[i].direction = LEFT;
              } else {
                       if (up_open == 1 || down_open == 1 ) {
                          found = 0;
                          while (found == 0) {  // go up or down, if possible
-                             if (rand()%2 == 0 && up_open == 1) {
+                             if (game_rand()%2 == 0 && up_open == 1) {
                                  found = 1;
                                  ghosts[i].direction = UP;
                              } else { 
@@ -2267,13 +3228,13 @@ void choose_ghost_direction (int i)
          case RIGHT: 
              // continue right (50% chance, else go up or down)
              //    if not, go left back (return)
-             if (right_open == 1 && (up_open == 1 || down_open == 1) && ((rand()%10 >= 5) )) {
+             if (right_open == 1 && (up_open == 1 || down_open == 1) && ((game_rand()%10 >= 5) )) {
                 ghosts[i].direction = RIGHT;
              } else {
                       if (up_open == 1 || down_open == 1 ) {
                          found = 0;
                          while (found == 0) {  // go up or down, if possible
-                             if (rand()%2 == 0 && up_open == 1) {
+                             if (game_rand()%2 == 0 && up_open == 1) {
                                  found = 1;
                                  ghosts[i].direction = UP;
                              } else { 
@@ -2296,13 +3257,13 @@ void choose_ghost_direction (int i)
          case UP:
              // continue up (50% chance, else go left or right)
              //    if not, go right down (return)
-             if (up_open == 1 && (left_open == 1 || right_open == 1) && ((rand()%10 >= 5) )) {
+             if (up_open == 1 && (left_open == 1 || right_open == 1) && ((game_rand()%10 >= 5) )) {
                 ghosts[i].direction = UP;
              } else {
                       if (left_open == 1 || right_open == 1 ) {
                          found = 0;
                          while (found == 0) {  // go left or right, if possible
-                             if (rand()%2 == 0 && left_open == 1) {
+                             if (game_rand()%2 == 0 && left_open == 1) {
                                  found = 1;
                                  ghosts[i].direction = LEFT;
                              } else { 
@@ -2325,13 +3286,13 @@ void choose_ghost_direction (int i)
          case DOWN: 
              // continue down (50% chance, else go left or right)
              //    if not, go right up (return)
-             if (down_open == 1 && (left_open == 1 || right_open == 1) && ((rand()%10 >= 5) )) {
+             if (down_open == 1 && (left_open == 1 || right_open == 1) && ((game_rand()%10 >= 5) )) {
                 ghosts[i].direction = DOWN;
              } else {
                       if (left_open == 1 || right_open == 1 ) {
                          found = 0;
                          while (found == 0) {  // go left or right, if possible
-                             if (rand()%2 == 0 && left_open == 1) {
+                             if (game_rand()%2 == 0 && left_open == 1) {
                                  found = 1;
                                  ghosts[i].direction = LEFT;
                              } else { 
@@ -2365,38 +3326,38 @@ int i;
   int direction_image_nr;  // needed for ghosts with status 4
 
   for (i = 0; i < NUM_GHOSTS; i++) {
-      rect.x = ghosts[i].x * factor + screen_offset_x;   // real x position  on screen
-      rect.y = ghosts[i].y * factor + screen_offset_y;
-      rect.w = 8 * factor;   // factor pixel
-      rect.h = 8 * factor;   // factor pixel
+      rect.x = ghosts[i].x;
+      rect.y = ghosts[i].y;
+      rect.w = 8;
+      rect.h = 8;
       
       if (ghosts[i].status == 1) {  // normal
            if (frame % 6 >= 0 && frame % 6 <=2 )   // move "feet" of ghosts every 6 frames
-             SDL_RenderCopy(gRenderer, 
+             render_copy(
                 images_textures[((ghosts[i].colour - 1) * 8) + 87 + (ghosts[i].direction -1)*2],  NULL, &rect);
            //                                               8 for colour
            else
-             SDL_RenderCopy(gRenderer, 
+             render_copy(
                 images_textures[((ghosts[i].colour - 1) * 8) + 87 + (ghosts[i].direction -1)*2 + 1],  NULL, &rect);
       }  // if status =1
       if (ghosts[i].status == 2) {   // can be eaten
           colour = 5;  // magenta
           if (powerpill_active_timer > 60) {  // magenta
              if (frame % 6 >= 0 && frame % 6 <=2 ) {   // move "feet" of ghosts every 6 frames
-               SDL_RenderCopy(gRenderer, 
+               render_copy(
                 images_textures[((colour - 1) * 8) + 87 + (ghosts[i].direction -1)*2],  NULL, &rect);
              } else {
-               SDL_RenderCopy(gRenderer, 
+               render_copy(
                 images_textures[((colour - 1) * 8) + 87 + (ghosts[i].direction -1)*2 + 1],  NULL, &rect);
 
              }  
           } else {  // flash magenta 5/cyan 4
              if (frame % 10 >= 0 && frame % 10 < 5 ) { colour = 5; } else { colour = 4; }
              if (frame % 6 >= 0 && frame % 6 <=2 ) {  // move "feet" of ghosts every 6 frames
-               SDL_RenderCopy(gRenderer, 
+               render_copy(
                 images_textures[((colour - 1) * 8) + 87 + (ghosts[i].direction -1)*2],  NULL, &rect);
              } else {
-               SDL_RenderCopy(gRenderer, 
+               render_copy(
                 images_textures[((colour - 1) * 8) + 87 + (ghosts[i].direction -1)*2 + 1],  NULL, &rect);
              }
           }  // timer > 30  
@@ -2413,10 +3374,10 @@ int i;
           }    
           if (frame % 20 >= 0 && frame % 20 < 14 ) { colour = 7; } else { colour = 6; }
              if (frame % 6 >= 0 && frame % 6 <=2 )   // move "feet" of ghosts every 6 frames
-               SDL_RenderCopy(gRenderer, 
+               render_copy(
                   images_textures[((colour - 1) * 8) + 87 + (direction_image_nr -1)*2],  NULL, &rect);
              else
-               SDL_RenderCopy(gRenderer, 
+               render_copy(
                   images_textures[((colour - 1) * 8) + 87 + (direction_image_nr -1)*2 + 1],  NULL, &rect);
        }   // if status = 3 or 4
    }     // for loop  
@@ -2428,84 +3389,41 @@ void draw_score_line()
 {
   SDL_Color fgColor_green  = {0,182,0};   
   SDL_Color fgColor_red    = {182,0,0};   
-  SDL_Color fgColor_cyan    = {0,182,182};  
   SDL_Color fgColor_yellow  = {182,182,0};  
   SDL_Color fgColor_grey   = {182,182,182};   // grey/white
-  SDL_Rect text_position;  
   char text_line[20]; 
 
   // arcade mode test
   if (arcade_mode == TRUE) {
      sprintf(text_line, "%s", "ARCADE MODE");
-     text = TTF_RenderText_Solid(font_small, text_line, fgColor_yellow);
-     text_texture = SDL_CreateTextureFromSurface( gRenderer, text );
-     text_position.x = 70       * factor + screen_offset_x;
-     text_position.y = 12 * factor + screen_offset_y;
-     text_position.w = text->w;
-     text_position.h = text->h;
-     SDL_RenderCopy(gRenderer, text_texture,  NULL, &text_position);
-     SDL_FreeSurface(text);
-     SDL_DestroyTexture(text_texture);
+     display_text_line(70, 12, "small", text_line, &fgColor_yellow);
   }
 
   // highscore in green
   sprintf(text_line, "%04d", high_score);
-  text = TTF_RenderText_Solid(font_large, text_line, fgColor_green);
-  text_texture = SDL_CreateTextureFromSurface( gRenderer, text );
-  text_position.x = 24       * factor + screen_offset_x;
-  text_position.y = (145-20) * factor + screen_offset_y;
-  text_position.w = text->w;
-  text_position.h = text->h;
-  SDL_RenderCopy(gRenderer, text_texture,  NULL, &text_position);
-  SDL_FreeSurface(text);
-  SDL_DestroyTexture(text_texture);
+  display_text_line(24, 145-20, "large", text_line, &fgColor_green);
   
   // arrow sign in grey/white
   sprintf(text_line, "%c", 124); // arrow-char in modified o2 font
-  text = TTF_RenderText_Solid(font_large, text_line, fgColor_grey);
-  text_texture = SDL_CreateTextureFromSurface( gRenderer, text );
-  text_position.x = (24 * factor) + (3 * 12 * factor) + screen_offset_x; // skip 3 chars
-  text_position.y = (145-20) * factor + screen_offset_y;
-  text_position.w = text->w;
-  text_position.h = text->h;
-  SDL_RenderCopy(gRenderer, text_texture,  NULL, &text_position);
-  SDL_FreeSurface(text);
-  SDL_DestroyTexture(text_texture);
+  display_text_line(24 + (3 * 12), 145-20, "large", text_line, &fgColor_grey);  // skip 3 chars
   
   // highscore name in green
   if (munchkin_dying == 1) {
     flash_high_score_name();
   } else {  
     sprintf(text_line, "%s ", high_score_name);
-    text = TTF_RenderText_Solid(font_large, text_line, fgColor_green);
-    text_texture = SDL_CreateTextureFromSurface( gRenderer, text );
-    text_position.x = (24 * factor) + (4 * 12 * factor) + screen_offset_x; // skip 4 chars
-    text_position.y = (145-20) * factor + screen_offset_y;
-    text_position.w = text->w;
-    text_position.h = text->h;
-    SDL_RenderCopy(gRenderer, text_texture,  NULL, &text_position);
-    SDL_FreeSurface(text);
-    SDL_DestroyTexture(text_texture);
+    display_text_line(24 + (4 * 12), 145-20, "large", text_line, &fgColor_green);  // skip 4 chars
   }
 
   // current score in red
   sprintf(text_line, " %04d", score);
-  text = TTF_RenderText_Solid(font_large, text_line, fgColor_red);
-  text_texture = SDL_CreateTextureFromSurface( gRenderer, text );
-  text_position.x = (24 * factor) + (9 * 12 * factor) + screen_offset_x; // skip 9 chars
-  text_position.y = (145-20) * factor + screen_offset_y;
-  text_position.w = text->w;
-  text_position.h = text->h;
-  SDL_RenderCopy(gRenderer, text_texture,  NULL, &text_position);
-  SDL_FreeSurface(text);
-  SDL_DestroyTexture(text_texture);
+  display_text_line(24 + (9 * 12), 145-20, "large", text_line, &fgColor_red);  // skip 9 chars
 }
 
 
 void flash_high_score_name()
 {
   SDL_Color fgColor_green  = {0,182,0};   
-  SDL_Rect text_position;  
   char text_line[6];
 
   if (high_score_broken == TRUE) strcpy(high_score_name, "??????");
@@ -2514,17 +3432,7 @@ void flash_high_score_name()
   sprintf(text_line, "%s ", high_score_name);
   
   text_line[flash_high_score_timer%6] = ' ';
-  text = TTF_RenderText_Solid(font_large, text_line, fgColor_green);
-  //Create texture from surface pixels
-  text_texture = SDL_CreateTextureFromSurface( gRenderer, text );
-  text_position.x = (24 * factor) + (4 * 12 * factor) + screen_offset_x; // skip 4 chars
-  text_position.y = (145-20) * factor + screen_offset_y;
-  text_position.w = text->w;
-  text_position.h = text->h;  
-
-  SDL_RenderCopy(gRenderer, text_texture,  NULL, &text_position);
-  SDL_FreeSurface(text);
-  SDL_DestroyTexture(text_texture);
+  display_text_line(24 + (4 * 12), 145-20, "large", text_line, &fgColor_green);  // skip 4 chars
   
   if (frame%3 == 0) {
     flash_high_score_timer--;
@@ -2537,7 +3445,6 @@ void print_high_score_char(int character)
 {
   SDL_Color fgColor_green = {0,182,0};   
   SDL_Color fgColor_red    = {182,0,0};   
-  SDL_Rect text_position;  
   char text_line[6];
   
   // highscore name in green
@@ -2552,35 +3459,17 @@ void print_high_score_char(int character)
     //printf("stop registration\n");
   }
     
-  text = TTF_RenderText_Solid(font_large, text_line, fgColor_green);
-  //Create texture from surface pixels
-  text_texture = SDL_CreateTextureFromSurface( gRenderer, text );
-  text_position.x = (24 * factor) + (4 * 12 * factor) + screen_offset_x; // skip 4 chars
-  text_position.y = (145-20) * factor + screen_offset_y;
-  text_position.w = text->w;
-  text_position.h = text->h;
-  SDL_RenderCopy(gRenderer, text_texture,  NULL, &text_position);
-  SDL_FreeSurface(text);
-  SDL_DestroyTexture(text_texture);
+  display_text_line(24 + (4 * 12), 145-20, "large", text_line, &fgColor_green);  // skip 4 chars
 
   // current score in red
   sprintf(text_line, " %04d", score);
-  text = TTF_RenderText_Solid(font_large, text_line, fgColor_red);
-  //Create texture from surface pixels
-  text_texture = SDL_CreateTextureFromSurface( gRenderer, text );
-  text_position.x = (24 * factor) + (9 * 12 * factor) + screen_offset_x; // skip 9 chars
-  text_position.y = (145-20) * factor + screen_offset_y;
-  text_position.w = text->w;
-  text_position.h = text->h;
-  SDL_RenderCopy(gRenderer, text_texture,  NULL, &text_position);
-  SDL_FreeSurface(text);
-  SDL_DestroyTexture(text_texture);
+  display_text_line(24 + (9 * 12), 145-20, "large", text_line, &fgColor_red);  // skip 9 chars
 
-  play_sound(7, -1);
+  play_sound(7);
 }
 
 
-void play_sound(int snd, int chan)
+void play_sound(int snd)
 {
    /* sounds:
          0 : not used
@@ -2590,164 +3479,604 @@ void play_sound(int snd, int chan)
          4 : not used
          5 : not used
          6 : score              
-         7 : character beep (on free channel
+         7 : character beep (more at once)
          8 : not used
          9 : not used
-        10 : select game (only in intro on free channel)  
-        11 : munchkin walk      channel 1
-        12 : munchkin eat pill  channel 2
-        13 : munchkin maze completed channel 3/  
-        14 : munchkin eat powerpill  channel 4
-        15 : munchkin ghost eaten channel 5 
-        16 : muchkin ghost move sound channel 6
-        17 : munchkin dying sound channel 7 
-        18 : intermission 1 
-        19 : intermisssion 2
+        10 : select game (only in intro)  
+        11 : munchkin walk (ambient loop, set_ambient_sound())
+        12 : munchkin eat pill
+        13 : munchkin maze completed
+        14 : munchkin eat powerpill
+        15 : munchkin ghost eaten
+        16 : muchkin ghost move sound (ambient loop, set_ambient_sound())
+        17 : munchkin dying sound
+        18 : intermission 1 (streamed, start_music())
+        19 : intermisssion 2 (streamed, start_music())
+       priority and what a sound stops are in sound_info[]
     */    
+    int voice, v, previous;
 
-    // Some tweaks to improve sounds (SDL_Mixer is not perfect)
+    if (SDL_AtomicGet(&audio_ready) == FALSE) return;    // audio device or sounds not ready (yet)
 
-    if (snd == 7 || snd == 18 || snd == 19)  chan = Mix_PlayChannel(chan, sounds[snd], 0);
+    // measure only sounds that start in silence, audio_post_mix() looks for their samples
+    if (measure_audio_latency == TRUE && SDL_AtomicGet(&mix_silent) == TRUE &&
+        SDL_AtomicGet(&latency_event_pending) == FALSE) {
+        latency_event_time = SDL_GetPerformanceCounter();
+        SDL_MemoryBarrierRelease();
+        SDL_AtomicSet(&latency_event_pending, TRUE);
+    }
 
-    if (snd == 10) {
-       if (Mix_Playing(7) != 0) Mix_HaltChannel(7);  // stop munchkin die sound;
-       if (Mix_Playing(3) != 0) Mix_HaltChannel(3);  // stop munchkin move sound
-       if (Mix_Playing(6) != 0) Mix_HaltChannel(6);  // stop ghosts move sound
-            chan = Mix_PlayChannel(chan, sounds[snd], 0);
-    }  
+    TRACE_BEGIN(play_sound);
+    stop_sounds(sound_info[snd].stops);
 
-    if (snd == 11 && chan == 1) {
-       if (Mix_Playing(6) != 0) Mix_HaltChannel(6);  // stop ghosts move sound;
-       if (Mix_Playing(chan) != 0) {
-            ; //printf("channel %d skiiped\n", chan);
-       } else {
-            //printf("channel %d played\n", chan);
-            chan = Mix_PlayChannel(chan, sounds[snd], 0);
-       }    
-    }   
+    // same sound again restarts on its voice, else a free voice, else steal
+    voice = -1;
+    if (sound_info[snd].multiple == FALSE) {
+        for (v = 0; v < NUM_VOICES; v++)
+            if (SDL_AtomicGet(&voice_busy[v]) != 0 && voice_sound[v] == snd) voice = v;
+    }
+    for (v = 0; v < NUM_VOICES && voice == -1; v++)
+        if (SDL_AtomicGet(&voice_busy[v]) == 0) voice = v;
+    if (voice == -1) {
+        for (v = 0; v < NUM_VOICES; v++) {
+            if (sound_info[voice_sound[v]].priority > sound_info[snd].priority) continue;
+            if (voice == -1 || sound_info[voice_sound[v]].priority < sound_info[voice_sound[voice]].priority ||
+                (sound_info[voice_sound[v]].priority == sound_info[voice_sound[voice]].priority && 
+                 voice_started[v] < voice_started[voice])) voice = v;
+        }
+    }
 
-    if (snd == 12 && chan == 2) {
-       if (Mix_Playing(chan) != 0) {
-            Mix_HaltChannel(chan); 
-            chan = Mix_PlayChannel(chan, sounds[snd], 0);
-       } else {
-            //printf("channel %d played\n", chan);
-            chan = Mix_PlayChannel(chan, sounds[snd], 0);
-       }    
-    }   
-
-    if (snd == 13 && chan == 3) {
-       if (Mix_Playing(6) != 0)  Mix_HaltChannel(6);  // stop ghosts move sound
-       if (Mix_Playing(1) != 0) Mix_HaltChannel(1);   // halt movement sound
-       chan = Mix_PlayChannel(chan, sounds[snd], 0);
-    }   
-
-    if (snd == 14 && chan == 4) {
-       if (Mix_Playing(chan) != 0) {
-            Mix_HaltChannel(chan); 
-            chan = Mix_PlayChannel(chan, sounds[snd], 0);
-       } else {
-            //printf("channel %d played\n", chan);
-            chan = Mix_PlayChannel(chan, sounds[snd], 0);
-       }    
-    }   
-
-    if (snd == 15 && chan == 5) {
-       if (Mix_Playing(1) != 0) Mix_HaltChannel(1);        // halt munchkin movement sound
-       //printf("eaten sound\n");
-       chan = Mix_PlayChannel(chan, sounds[snd], 0);
-    }  
-
-    if (snd == 16 && chan == 6) {
-       if (Mix_Playing(1) != 0)  Mix_HaltChannel(1);  // stop munchkin move sound
-       if (Mix_Playing(chan) != 0) {
-            ; //printf("channel %d skiiped\n", chan);
-       } else {
-            //printf("channel %d played\n", chan);
-            chan = Mix_PlayChannel(chan, sounds[snd], 0);
-       }    
-    }   
+    if (voice != -1) {          // else all voices play more important sounds
+        if (++voice_generation <= 0) voice_generation = 1;
+        // busy before the command is seen, the audio thread may free the voice at once
+        previous = SDL_AtomicSet(&voice_busy[voice], voice_generation);
+        if (push_audio_command(AUDIO_PLAY, voice, snd, voice_generation) == TRUE) {
+            if (voice_sound[voice] == ambient_sound && voice_sound[voice] != snd) ambient_sound = 0;
+            voice_sound[voice] = snd;
+            voice_started[voice] = frame;
+        } else {
+            // a restarted or stolen voice still plays its old sound
+            SDL_AtomicCAS(&voice_busy[voice], voice_generation, previous);
+        }
+    }
+    TRACE_END(play_sound);
+}
 
-    if (snd == 17 && chan == 7) {
-       if (Mix_Playing(6) != 0) Mix_HaltChannel(6);  // stop ghosts move sound;
-       if (Mix_Playing(1) != 0) Mix_HaltChannel(1);  // stop munchkin move sound
-            chan = Mix_PlayChannel(chan, sounds[snd], 0);
-    }    
 
+void set_ambient_sound(int snd)      // every frame in the game: 11 walk, 16 ghosts, 0 none
+{
+    if (snd == ambient_sound || SDL_AtomicGet(&audio_ready) == FALSE) return;    // no mixer call
+    if (snd == 0) stop_sounds(STOPS(ambient_sound));
+      else play_sound(snd);           // stops the other loop
+    ambient_sound = snd;
 }
 
 
-void toggle_full_screen_mode(int fullscreen)
+void stop_sounds(Uint32 stops)
 {
+    int v;
+
+    for (v = 0; v < NUM_VOICES; v++) {
+        if (SDL_AtomicGet(&voice_busy[v]) != 0 && (stops & STOPS(voice_sound[v]))) {
+            if (push_audio_command(AUDIO_STOP, v, voice_sound[v], SDL_AtomicGet(&voice_busy[v])) == FALSE)
+                continue;           // ring full: still playing, try again next time
+            SDL_AtomicSet(&voice_busy[v], 0);
+            if (voice_sound[v] == ambient_sound) ambient_sound = 0;   // next frame starts it again
+        }
+    }
+}
 
-  SDL_DestroyRenderer(gRenderer);
-  SDL_DestroyWindow( gWindow );   
-
-  if (fullscreen == TRUE) {
-            // set monitor resolution
-            screen_width = 1366; 
-            screen_height = 768; 
-            factor = 5;
-
-            gWindow  = SDL_CreateWindow( "MUNCHKIN",SDL_WINDOWPOS_CENTERED,
-                                     SDL_WINDOWPOS_CENTERED, screen_width, screen_height, 
-                                     SDL_WINDOW_FULLSCREEN | SDL_WINDOW_INPUT_GRABBED );
-            if ( gWindow == NULL ) {
-               printf( "Fullscreen Window could not be created! SDL_Error: %s\n", SDL_GetError() );
-               exit(1);
-            }
-
-            SDL_DisplayMode dm;
-            if (SDL_GetDesktopDisplayMode(0, &dm) != 0) {
-              printf("cannot get display mode\n");
-              exit(1);
-            } 
 
-    } else {
-             screen_width = 1366; 
-             screen_height = 768; 
-             factor = 5;
-             printf("back to windowed, factor %d\n", factor);
-
-             gWindow = SDL_CreateWindow( "MUNCHKIN", SDL_WINDOWPOS_UNDEFINED, 
-                 SDL_WINDOWPOS_UNDEFINED, screen_width, screen_height, SDL_WINDOW_SHOWN );
-             if( gWindow == NULL ) {
-                printf( "Window could not be created! SDL_Error: %s\n", SDL_GetError() );
-                exit(1);
-             }
+int push_audio_command(int type, int voice, int sound, int generation)    // game thread
+{
+    audio_command_type *command;
+    int head;
+
+    head = SDL_AtomicGet(&audio_command_head);
+    if (head - SDL_AtomicGet(&audio_command_tail) == AUDIO_COMMANDS) {
+        audio_commands_dropped++;         // never wait for the audio thread
+        return(FALSE);
+    }
+    command = &audio_commands[head & (AUDIO_COMMANDS - 1)];
+    command->type = type;
+    command->voice = voice;
+    command->sound = sound;
+    command->generation = generation;
+    command->volume = effects_volume;
+    command->time = SDL_GetPerformanceCounter();
+    SDL_MemoryBarrierRelease();           // command is complete before the audio thread sees it
+    SDL_AtomicSet(&audio_command_head, head + 1);
+    return(TRUE);
+}
+
+
+void toggle_full_screen_mode(int fullscreen)
+{
+  SDL_Rect usable;
+  int new_factor;
 
-    }       // if fullscreen
+  if (gWindow == NULL) {   // first call: create window and renderer
+    
+      if (window_width <= 0 || window_height <= 0) {
+          new_factor = requested_factor;
+          if (new_factor <= 0) {   // largest that fits on the desktop
+              if (SDL_GetDisplayUsableBounds(0, &usable) != 0) {
+                  printf("cannot get display bounds: %s\n", SDL_GetError());
+                  usable.w = 1000; usable.h = 800;
+              } 
+              new_factor = largest_factor(usable.w, usable.h);
+          }
+          window_width  = VIDEOPAC_RES_W * new_factor;
+          window_height = VIDEOPAC_RES_H * new_factor;
+      }
 
-    gRenderer = SDL_CreateRenderer(gWindow, -1, SDL_RENDERER_ACCELERATED); 
-    if (gRenderer == NULL) {
-         printf( "Renderer could not be created! SDL_Error: %s\n", SDL_GetError() );
+      gWindow = SDL_CreateWindow( "MUNCHKIN", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                     window_width, window_height,
+                     (fullscreen == TRUE) ? SDL_WINDOW_FULLSCREEN_DESKTOP : SDL_WINDOW_SHOWN );
+      if( gWindow == NULL ) {
+         printf( "Window could not be created! SDL_Error: %s\n", SDL_GetError() );
          exit(1);
-    }  
+      }
+
+      if (software_rendering == FALSE) {
+          gRenderer = SDL_CreateRenderer(gWindow, -1, SDL_RENDERER_ACCELERATED | 
+                                         (use_vsync == TRUE ? SDL_RENDERER_PRESENTVSYNC : 0)); 
+          if (gRenderer == NULL) {
+               printf( "No accelerated renderer (%s), using software rendering\n", SDL_GetError() );
+               software_rendering = TRUE;
+          }
+      }  
+      if (software_rendering == TRUE) setup_software_rendering();
     
-    screen_offset_x = (screen_width - (screen_height / 4) * 5) / 2;
-    screen_offset_y = 0;
-    load_images();
+      // draw everything in Videopac pixels, SDL scales (nearest, whole factors only) 
+      // and centers it in the window
+      SDL_RenderSetLogicalSize(gRenderer, VIDEOPAC_RES_W, VIDEOPAC_RES_H);
+      SDL_RenderSetIntegerScale(gRenderer, SDL_TRUE);
+      load_images();
+
+  } else {
+      // fullscreen at desktop resolution: no display mode switch, window and
+      // textures are kept
+      if (SDL_SetWindowFullscreen(gWindow, (fullscreen == TRUE) ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0) != 0)
+          printf("Cannot switch full screen: %s\n", SDL_GetError());
+      full_redraw = TRUE;
+  }       
+
+  // factor for the text, same as SDL uses for the logical size
+  SDL_GetRendererOutputSize(gRenderer, &screen_width, &screen_height);
+  new_factor = largest_factor(screen_width, screen_height);
+  if (new_factor != factor || font_large == NULL) {
+      factor = new_factor;
+      open_fonts();
+  }
+  printf("screen %dx%d, factor %d\n", screen_width, screen_height, factor);
+}
+
+
+void setup_software_rendering()
+{
+  SDL_Surface * window_surface;
+
+  window_surface = SDL_GetWindowSurface(gWindow);
+  if (window_surface == NULL) {
+      printf( "Window surface could not be created! SDL_Error: %s\n", SDL_GetError() );
+      exit(1);
+  }
+
+  // same pixel format as the window, so copying to it is a plain (scaled) blit
+  framebuffer = SDL_CreateRGBSurfaceWithFormat(0, VIDEOPAC_RES_W, VIDEOPAC_RES_H, 32, 
+                                               window_surface->format->format);
+  last_framebuffer = SDL_CreateRGBSurfaceWithFormat(0, VIDEOPAC_RES_W, VIDEOPAC_RES_H, 32, 
+                                                    window_surface->format->format);
+  if (framebuffer == NULL || last_framebuffer == NULL) {
+      printf( "Framebuffer could not be created! SDL_Error: %s\n", SDL_GetError() );
+      exit(1);
+  }
+
+  gRenderer = SDL_CreateSoftwareRenderer(framebuffer);
+  if (gRenderer == NULL) {
+      printf( "Renderer could not be created! SDL_Error: %s\n", SDL_GetError() );
+      exit(1);
+  }  
+  full_redraw = TRUE;
+}
+
+
+void start_capture(char *file_name)
+{
+  char *extension;
+
+  capture_file = fopen(file_name, "wb");
+  if (capture_file == NULL) {
+      fprintf(stderr, "Cannot open capture file %s: %s\n", file_name, strerror(errno));
+      exit(1);
+  }
+
+  // name ending in .ppm: PPM images one after another, else Y4M video (as ffmpeg reads it)
+  extension = strrchr(file_name, '.');
+  capture_y4m = !(extension != NULL && strcmp(extension, ".ppm") == 0);
+  if (capture_y4m == TRUE) {
+      SDL_SetYUVConversionMode(SDL_YUV_CONVERSION_JPEG);     // full range, same as C420jpeg
+      fprintf(capture_file, "YUV4MPEG2 W%d H%d F30:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n", 
+              (int)VIDEOPAC_RES_W, (int)VIDEOPAC_RES_H);
+  }
+
+  capture_free = SDL_CreateSemaphore(2);
+  capture_full = SDL_CreateSemaphore(0);
+  capture_thread = SDL_CreateThread(capture_writer, "capture", NULL);
+  if (capture_thread == NULL) {
+      fprintf(stderr, "Cannot start capture thread: %s\n", SDL_GetError());
+      exit(1);
+  }
+}
+
+
+void capture_frame()
+{
+  Uint8 *buffer;
+  int header;
+
+  // wait for a buffer, only when the writer is 2 frames behind
+  SDL_SemWait(capture_free);
+  buffer = capture_buffers[capture_fill];
+
+  if (capture_y4m == TRUE) {
+      header = sprintf((char *)buffer, "FRAME\n");
+      SDL_ConvertPixels(VIDEOPAC_RES_W, VIDEOPAC_RES_H, framebuffer->format->format, 
+                        framebuffer->pixels, framebuffer->pitch,
+                        SDL_PIXELFORMAT_IYUV, buffer + header, VIDEOPAC_RES_W);
+      capture_buffer_used[capture_fill] = header + VIDEOPAC_RES_W * VIDEOPAC_RES_H * 3 / 2;
+  } else {
+      header = sprintf((char *)buffer, "P6\n%d %d\n255\n", (int)VIDEOPAC_RES_W, (int)VIDEOPAC_RES_H);
+      SDL_ConvertPixels(VIDEOPAC_RES_W, VIDEOPAC_RES_H, framebuffer->format->format, 
+                        framebuffer->pixels, framebuffer->pitch,
+                        SDL_PIXELFORMAT_RGB24, buffer + header, VIDEOPAC_RES_W * 3);
+      capture_buffer_used[capture_fill] = header + VIDEOPAC_RES_W * VIDEOPAC_RES_H * 3;
+  }
+
+  capture_fill = 1 - capture_fill;
+  SDL_SemPost(capture_full);
+
+  captured_frames++;
+  if (capture_frames > 0 && captured_frames >= capture_frames) exit(0);
+}
+
+
+int capture_writer(void *data)
+{
+  int i;
+
+  i = 0;
+  while (TRUE) {
+      SDL_SemWait(capture_full);
+      if (capture_buffer_used[i] < 0) break;     // stop_capture()
+      TRACE_BEGIN(capture_write);
+      if (fwrite(capture_buffers[i], 1, capture_buffer_used[i], capture_file) != capture_buffer_used[i])
+          fprintf(stderr, "Cannot write capture frame: %s\n", strerror(errno));
+      TRACE_END(capture_write);
+      i = 1 - i;
+      SDL_SemPost(capture_free);
+  }
+  return(0);
+}
+
+
+void stop_capture()
+{
+  // the end marker is written after all frames still in the buffers
+  SDL_SemWait(capture_free);
+  capture_buffer_used[capture_fill] = -1;
+  SDL_SemPost(capture_full);
+  SDL_WaitThread(capture_thread, NULL);
+
+  fclose(capture_file);
+  capture_file = NULL;
+  printf("%d frames captured\n", captured_frames);
+}
+
+
+void wait_for_next_frame(Uint32 last_time)
+{
+  if (golden_dir != NULL) return;      // golden image test runs as fast as it can
+  if (idle_skip == TRUE) return;       // the next drawn idle frame waits for this one too
+
+  if (idle == TRUE) {                  // one wakeup per drawn frame, a press ends the sleep
+      if (SDL_GetTicks() < last_time + 33 * IDLE_REDRAW)
+          SDL_WaitEventTimeout(NULL, last_time + 33 * IDLE_REDRAW - SDL_GetTicks());
+      return;
+  }
+  if (SDL_GetTicks() < last_time + 33)
+      SDL_Delay(last_time + 33 - SDL_GetTicks());
+}
+
+
+void render_copy(SDL_Texture *texture, const SDL_Rect *src, const SDL_Rect *dst)
+{
+  if (skip_drawing == TRUE) return;
+  draw_calls++;
+  if (texture != last_texture) texture_switches++;
+  last_texture = texture;
+  SDL_RenderCopy(gRenderer, texture, src, dst);
+}
+
+
+void render_copy_f(SDL_Texture *texture, const SDL_Rect *src, const SDL_FRect *dst)
+{
+  if (skip_drawing == TRUE) return;
+  draw_calls++;
+  if (texture != last_texture) texture_switches++;
+  last_texture = texture;
+  SDL_RenderCopyF(gRenderer, texture, src, dst);
+}
+
+
+Uint64 prof_start()
+{
+  return(SDL_GetPerformanceCounter());
+}
+
+
+void prof_stop(int zone, Uint64 start)
+{
+  prof_zone_ticks[zone] += SDL_GetPerformanceCounter() - start;
+#ifdef MUNCHKIN_TRACE
+  trace_add(prof_zone_names[zone], start);
+#endif
+}
+
+
+void prof_end_frame(Uint64 frame_start)    // after present, before the wait for the next frame
+{
+  int i;
+  float to_ms;
+
+  to_ms = 1000.0 / SDL_GetPerformanceFrequency();
+  for (i = 0; i < PROF_ZONES; i++) {
+     prof_zone_ms[i] = prof_zone_ticks[i] * to_ms;
+     prof_zone_ticks[i] = 0;
+  }
+
+  prof_frame_ms[prof_history_pos] = (SDL_GetPerformanceCounter() - frame_start) * to_ms;
+  if (prof_frame_ms[prof_history_pos] > 33) prof_missed++;
+  prof_history_pos = (prof_history_pos + 1) % PROF_HISTORY;
+  if (prof_history_frames < PROF_HISTORY) prof_history_frames++;
+
+  prof_draw_calls = draw_calls;
+  prof_texture_switches = texture_switches;
+  prof_textures_created = textures_created;
+  draw_calls = 0;
+  texture_switches = 0;
+  textures_created = 0;
+  last_texture = NULL;
+}
+
+
+int compare_ms(const void *a, const void *b)
+{
+  float fa = *(const float *)a, fb = *(const float *)b;
+  return((fa > fb) - (fa < fb));
+}
+
+
+void draw_profiler()
+{
+  SDL_Color fgColor_green = {0,182,0};   
+  SDL_Color fgColor_red   = {182,0,0};   
+  SDL_Color fgColor_grey  = {182,182,182};  
+  SDL_FRect rect;
+  float sorted[PROF_HISTORY];
+  int buckets[PROF_BUCKETS];
+  int i, bucket, max_count, keep_calls, keep_switches, keep_created;
+
+  // the overlay itself is not counted
+  keep_calls = draw_calls;  keep_switches = texture_switches;  keep_created = textures_created;
+
+  // numbers change 3 times per second, so the text is not rasterized every frame
+  if ((frame % 10 == 0 || prof_text[0][0] == '\0') && prof_history_frames > 0) {
+     memcpy(sorted, prof_frame_ms, sizeof(sorted));
+     qsort(sorted, prof_history_frames, sizeof(float), compare_ms);
+     sprintf(prof_text[0], "IN %4.1f  UPD %4.1f", prof_zone_ms[PROF_INPUT], prof_zone_ms[PROF_UPDATE]);
+     sprintf(prof_text[1], "DRAW %4.1f PRES %4.1f", prof_zone_ms[PROF_RENDER], prof_zone_ms[PROF_PRESENT]);
+     sprintf(prof_text[2], "P50 %4.1f P99 %4.1f", sorted[prof_history_frames / 2], 
+                                                   sorted[(prof_history_frames * 99) / 100]);
+     sprintf(prof_text[3], "MISSED %d LATE %d", prof_missed, SDL_AtomicGet(&audio_late_buffers));
+     sprintf(prof_text[4], "CALLS %d SW %d NEW %d", prof_draw_calls, prof_texture_switches, 
+                                                     prof_textures_created);
+     if (SDL_AtomicGet(&latency_count) > 0)
+        sprintf(prof_text[5], "AUDIO %4.1f MAX %4.1f", 
+                SDL_AtomicGet(&latency_average_us) / 1000.0,
+                SDL_AtomicGet(&latency_max_us) / 1000.0);
+     else
+        sprintf(prof_text[5], "AUDIO BUF %4.1f", (audio_device_rate > 0) ? 1000.0 * audio_buffer / audio_device_rate : 0);
+  }
+
+  SDL_SetRenderDrawBlendMode(gRenderer, SDL_BLENDMODE_BLEND);
+  SDL_SetRenderDrawColor(gRenderer, 0x0, 0x0, 0x0, 0xc0);
+  rect.x = 0;  rect.y = 0;  rect.w = 110;  rect.h = 61;
+  SDL_RenderFillRectF(gRenderer, &rect);
+
+  for (i = 0; i < 6; i++) 
+     if (prof_text[i][0] != '\0')     // no numbers yet
+        display_text_line(2, 1 + i * 7, "small", prof_text[i], (i == 3) ? &fgColor_red : &fgColor_grey);
+
+  // histogram of the frame times in the history, 4 ms per bar, red from 32 ms
+  memset(buckets, 0, sizeof(buckets));
+  for (i = 0; i < prof_history_frames; i++) {
+     bucket = prof_frame_ms[i] / 4;
+     if (bucket >= PROF_BUCKETS) bucket = PROF_BUCKETS - 1;
+     buckets[bucket]++;
+  }
+  max_count = 1;
+  for (i = 0; i < PROF_BUCKETS; i++) if (buckets[i] > max_count) max_count = buckets[i];
+  for (i = 0; i < PROF_BUCKETS; i++) {
+     if (i < 8) SDL_SetRenderDrawColor(gRenderer, fgColor_green.r, fgColor_green.g, fgColor_green.b, 0xff);
+       else SDL_SetRenderDrawColor(gRenderer, fgColor_red.r, fgColor_red.g, fgColor_red.b, 0xff);
+     rect.h = buckets[i] * 14.0 / max_count;
+     rect.x = 2 + i * 8;
+     rect.y = 59 - rect.h;
+     rect.w = 6;
+     SDL_RenderFillRectF(gRenderer, &rect);
+  }
+  SDL_SetRenderDrawBlendMode(gRenderer, SDL_BLENDMODE_NONE);
+
+  draw_calls = keep_calls;  texture_switches = keep_switches;  textures_created = keep_created;
+}
+
+
+void present_screen()
+{
+  if (skip_drawing == TRUE) return;    // idle frame, the last one stays on screen
+  SDL_RenderPresent(gRenderer);      // software renderer: finishes drawing in framebuffer
+  if (software_rendering == TRUE) update_window_surface();
+  if (latency_press_time != 0) record_input_latency();    // --input-latency
+}
+
+
+void update_window_surface()     // software rendering: copy the changed parts to the window
+{
+  SDL_Surface * window_surface;
+  SDL_Rect src, dst;
+  int scale, offset_x, offset_y, tile_x, tile_y, first_tile, num_rects, i;
+
+  if (golden_scene[0] != '\0') golden_key_frame();
+  if (capture_file != NULL) capture_frame();
+  else if (headless == TRUE && capture_frames > 0 && ++captured_frames >= capture_frames) exit(0);
+
+  // window surface is new after a resize or full screen switch
+  window_surface = SDL_GetWindowSurface(gWindow);
+  if (window_surface == NULL) return;
+  if (window_surface != last_window_surface) full_redraw = TRUE;
+  last_window_surface = window_surface;
+
+  scale = largest_factor(window_surface->w, window_surface->h);
+  offset_x = (window_surface->w - VIDEOPAC_RES_W * scale) / 2;
+  offset_y = (window_surface->h - VIDEOPAC_RES_H * scale) / 2;
+
+  num_rects = 0;
+  if (full_redraw == TRUE) {
+      SDL_FillRect(window_surface, NULL, 0);    // black borders
+      dirty_rects[0].x = 0;  dirty_rects[0].y = 0;
+      dirty_rects[0].w = VIDEOPAC_RES_W;  dirty_rects[0].h = VIDEOPAC_RES_H;
+      num_rects = 1;
+  } else {
+      // changed tiles, next to each other in a row become 1 rectangle
+      for (tile_y = 0; tile_y < VIDEOPAC_RES_H / DIRTY_TILE; tile_y++) {
+          first_tile = -1;
+          for (tile_x = 0; tile_x <= VIDEOPAC_RES_W / DIRTY_TILE; tile_x++) {
+              if (tile_x < VIDEOPAC_RES_W / DIRTY_TILE && tile_changed(tile_x, tile_y)) {
+                  if (first_tile < 0) first_tile = tile_x;
+              } else if (first_tile >= 0) {
+                  dirty_rects[num_rects].x = first_tile * DIRTY_TILE;
+                  dirty_rects[num_rects].y = tile_y * DIRTY_TILE;
+                  dirty_rects[num_rects].w = (tile_x - first_tile) * DIRTY_TILE;
+                  dirty_rects[num_rects].h = DIRTY_TILE;
+                  num_rects++;
+                  first_tile = -1;
+              }
+          }
+      }
+  }
+  if (num_rects == 0) return;       // nothing moved
+
+  for (i = 0; i < num_rects; i++) {
+      src = dirty_rects[i];
+      SDL_BlitSurface(framebuffer, &src, last_framebuffer, &dirty_rects[i]);
+      dst.x = offset_x + src.x * scale;
+      dst.y = offset_y + src.y * scale;
+      dst.w = src.w * scale;
+      dst.h = src.h * scale;
+      SDL_BlitScaled(framebuffer, &src, window_surface, &dst);
+      dirty_rects[i] = dst;        // now in window pixels
+  }
+
+  if (full_redraw == TRUE) 
+      SDL_UpdateWindowSurface(gWindow);
+  else
+      SDL_UpdateWindowSurfaceRects(gWindow, dirty_rects, num_rects);
+  full_redraw = FALSE;
+}
+
+
+int tile_changed(int tile_x, int tile_y)
+{
+  Uint8 *now, *before;
+  int row, bpp;
+
+  bpp = framebuffer->format->BytesPerPixel;
+  now    = (Uint8 *)framebuffer->pixels + (tile_y * DIRTY_TILE) * framebuffer->pitch
+                                        + (tile_x * DIRTY_TILE) * bpp;
+  before = (Uint8 *)last_framebuffer->pixels + (tile_y * DIRTY_TILE) * last_framebuffer->pitch
+                                             + (tile_x * DIRTY_TILE) * bpp;
+  for (row = 0; row < DIRTY_TILE; row++) {
+      if (memcmp(now, before, DIRTY_TILE * bpp) != 0) return TRUE;
+      now += framebuffer->pitch;
+      before += last_framebuffer->pitch;
+  }
+  return FALSE;
+}
+
+
+int largest_factor(int width, int height)
+{
+  int new_factor;
+
+  new_factor = width / (int)VIDEOPAC_RES_W;
+  if (height / (int)VIDEOPAC_RES_H < new_factor) new_factor = height / (int)VIDEOPAC_RES_H;
+  if (new_factor < 1) new_factor = 1;
+  return(new_factor);
+}
+
+
+void open_fonts()
+{
+   if (font_large) TTF_CloseFont(font_large);
+   if (font_small) TTF_CloseFont(font_small);
+   flush_text_cache();
+
+   font_size = 12 * factor;     // text is rendered at window resolution, not scaled up
+   font_large = open_font(font_size);
+   if (!font_large)
+      fprintf(stderr, "Cannot load font name O2.ttf large: %s\n", SDL_GetError());
+
+   font_small = open_font(font_size/2);
+   if (!font_small)
+      fprintf(stderr, "Cannot load font name O2.ttf small: %s\n", SDL_GetError());
+}
+
+
+TTF_Font * open_font(int size)
+{
+   const pack_entry_type *entry;
+
+   entry = find_pack_entry("O2.ttf");
+   if (entry != NULL)
+      return(TTF_OpenFontRW(SDL_RWFromConstMem(pack_data + entry->offset, entry->size), 1, size));
+
+   // read the file once, both sizes (and every resize) use the same bytes
+   if (font_data == NULL) font_data = SDL_LoadFile("O2.ttf", &font_data_size);
+   if (font_data == NULL) return(NULL);
+   return(TTF_OpenFontRW(SDL_RWFromConstMem(font_data, font_data_size), 1, size));
 }
 
 
 
 void title_screen()
 {
-  int done, x, y, ux, uy, window_size_changed, scroll_x;
-  Uint32 last_time;
+  int done, ux, uy, window_size_changed, scroll_x;
+  float x, y;                 // position of "SELECT GAME", can wobble between pixels
+  Uint32 last_time, pressed;
   SDL_Event event;
-  SDL_Keycode key;
   char title_string[100];
   int active_option_row;
 
   /* title screen loop */
   start_delay = frame;
   done = FALSE;
-  play_sound(10,-1);    // select game 
+  play_sound(10);    // select game 
 
-  x = (VIDEOPAC_RES_W / 2 * factor) - (12*4*factor) + screen_offset_x;  // center - 5 characters
-                                                                        // (large font is 12 pixels char)
-  y = (VIDEOPAC_RES_H / 2 * factor) - (5 * factor) + screen_offset_y;
+  x = (VIDEOPAC_RES_W / 2) - (12*4);  // center - 5 characters
+                                      // (large font is 12 pixels char)
+  y = (VIDEOPAC_RES_H / 2) - 5;
 
   //joy_up = FALSE; joy_down = FALSE; joy_left = FALSE; joy_right = FALSE;
   if (arcade_mode == TRUE)
@@ -2756,360 +4085,187 @@ void title_screen()
   scroll_x = 0;
   powerpill_color = 1;
 
+  if (title_textures_factor != factor) prerender_title_screen();
   switch_active_mini_map(maze_selected); 
 
   do
   {
+    pause_while_inactive();
     last_time = SDL_GetTicks();
+    TRACE_BEGIN(title_frame);
       
     /* Check for key presses and joystick actions */
     while (SDL_PollEvent(&event))
     {
-      if (event.type == SDL_JOYBUTTONDOWN  && (event.jbutton.button == 0 ||
-                                               event.jbutton.button == 1)) {     
-        //printf("Joystick fire button A or B pressed, start normal game\n");      
-        sprintf(title_string, "Munchkin - maze: %d - ghosts: %d - pills: %d"
-                              , maze_selected, NUM_GHOSTS, NUM_PILLS);
-        SDL_SetWindowTitle(gWindow, title_string);  
-        done = TRUE;
-      }   
-
-      if (event.type == SDL_JOYAXISMOTION ) {  // prevent many actions at once
-        // check if joystick 0 has moved
-        if ( event.jaxis.which == 0 ) {
-            //If the X axis changed
-            if ( event.jaxis.axis == 0 ) {
-                //If the X axis is neutral
-                if ( ( event.jaxis.value > -8000 ) && ( event.jaxis.value < 8000 ) ) {
-                     joy_left = 0;
-                     joy_right = 0;
-                } else {
-                    //Adjust the velocity
-                    if ( event.jaxis.value < 0 ) {
-                        joy_left = 1;
-                        joy_right = 0;
-                    } else {
-                        joy_left = 0;
-                        joy_right = 1;
-                    }
-                }
-            }
-            //If the Y axis changed
-            else if ( event.jaxis.axis == 1 ) {
-                //If the Y axis is neutral
-                if ( ( event.jaxis.value > -8000 ) && ( event.jaxis.value < 8000 ) ) {
-                     joy_up = 0;
-                     joy_down = 0;
-                } else {
-                    //Adjust the velocity
-                    if ( event.jaxis.value < 0 ) {
-                     joy_up = 1;
-                     joy_down = 0;
-                    } else {
-                        joy_up = 0;
-                        joy_down = 1;
-                    }
-                }
-            }
-        }   // if event.jaxis.which == 0   
-      }  // event.type == SDL_JOYAXISMOTION
-
-        //printf("last_joystick_action: %d LRUP %d %d %d %d \n", last_joystick_action, 
-        //            joy_left, joy_right, joy_up, joy_down);
-        // check joystick action (process only one action at a time)
-
-        if (last_joystick_action == TRUE &&
-            joy_up == 0 && joy_down == 0 && joy_left == 0 && joy_right == 0 ) {        
-              last_joystick_action = FALSE;
-              //printf("--- switch to FALSE \n");
-        }    
-
-
-        if (last_joystick_action == FALSE && 
-            (joy_up == 1 || joy_down == 1 || joy_left == 1 || joy_right == 1) ) {
+      if (event.type == SDL_QUIT) exit(0);     // close window pressed
+    }
+    pressed = input_tick();                    // keys and joystick, see input_watch()
 
-             //printf("--- switch to TRUE \n");
-             last_joystick_action = TRUE;
-             if (joy_up == 1 || joy_down == 1 || joy_left == 1 || joy_right == 1) {  // select just 1 movement
+    if (pressed & ACTION_BACK) exit(0);        // escape, home/start button on joystick
 
-                 if (joy_up == 1)  {
-                    if (active_option_row > 1 && arcade_mode == FALSE) active_option_row --;
-                    if (active_option_row == 5 && arcade_mode == TRUE) active_option_row = 2;
-                 }
+    if (pressed & ACTION_FULL_SCREEN) {        // key 8: toggle full screen
+        full_screen = !full_screen;
+        toggle_full_screen_mode(full_screen);
+    }
 
-                 if (joy_down == 1) {
-                   if (active_option_row < 5 && arcade_mode == FALSE) active_option_row ++;
-                   if (active_option_row == 2 && arcade_mode == TRUE) active_option_row = 5;
-                 } 
-                 
-                 if (joy_right == 1) {  
-                   switch (active_option_row) {
-                     case(1):  // maze option
-                        maze_selected++;
-                        if (maze_selected == 5) maze_selected = 1;
-                        switch_active_mini_map(maze_selected);
-                        break;
-                     case(2):  // arcade mode option
-                       if (arcade_mode == FALSE) {
-                            arcade_mode = TRUE;
-                            maze_selected = 1;
-                            switch_active_mini_map(1);
-                            NUM_GHOSTS = 4;
-                            NUM_PILLS = 12;
-                       } else { arcade_mode = FALSE; }
-                       break;
-                      case(3): // ghosts option
-                        NUM_GHOSTS++;
-                        if (NUM_GHOSTS > 10) NUM_GHOSTS = 10; 
-                        break;
-                      case(4): // pills option
-                        NUM_PILLS++;
-                        if (NUM_PILLS > 99) NUM_PILLS = 99; 
-                        break;
-                      case(5): // start option
-                        sprintf(title_string, "Munchkin - maze: %d - ghosts: %d - pills: %d"
-                               ,maze_selected, NUM_GHOSTS, NUM_PILLS);
-                        SDL_SetWindowTitle(gWindow, title_string);  
-                        done = TRUE;
-                        break;
-                   }  // end switch option row
-                 }    // (joy_right == 1)
-
-                 if (joy_left == 1) {
-                    switch (active_option_row) {
-                      case(1):  // maze option
-                        maze_selected--;
-                        if (maze_selected == 0) maze_selected = 4;
-                        switch_active_mini_map(maze_selected);
-                        break;
-                     case(2):  // arcade mode option
-                       if (arcade_mode == FALSE) {
-                             arcade_mode = TRUE;
-                            maze_selected = 1;
-                            switch_active_mini_map(1);
-                            NUM_GHOSTS = 4;
-                            NUM_PILLS = 12;
-                       } else { arcade_mode = FALSE; }
-                       break;
-                      case(3): // ghosts option
-                         NUM_GHOSTS--;
-                         if (NUM_GHOSTS < 1) NUM_GHOSTS = 1; 
-                         break;
-                      case(4): // pills option
-                         NUM_PILLS--;
-                         if (NUM_PILLS < 12) NUM_PILLS = 12; 
-                         break;
-                       case(5): // start option
-                         sprintf(title_string, "Munchkin - maze: %d - ghosts: %d - pills: %d"
-                                , maze_selected, NUM_GHOSTS, NUM_PILLS);
-                         SDL_SetWindowTitle(gWindow, title_string);  
-                         done = TRUE;
-                         break;
-                    }  // end switch option row
-                 }  // (joy_left == 1)
-              }   // joy_up == 1 || joy_down == 1 || joy_left == 1 || joy_right == 1)
-   } //(last_joystick_action == FALSE
-          
+    if (pressed & ACTION_FIRE) done = TRUE;    // 1, Enter, Ctrl or fire button: start game
 
-      
-      if (event.type == SDL_KEYDOWN) {
-          key = event.key.keysym.sym;
-           if (key == 1073742048 || key == 49 || key == 13) {  // Button 1, Key Enter or Left Ctrl pressed
-                sprintf(title_string, "Munchkin - maze: %d - ghosts: %d - pills: %d"
-                                    , maze_selected, NUM_GHOSTS, NUM_PILLS);
-                SDL_SetWindowTitle(gWindow, title_string);  
-                done = TRUE;            
-           } 
-
-           if (key >= 1073741903 && key <= 1073741906) {  // handle arrowkeys
-             switch (key) {
-               case 1073741906:  // up
-                   if (active_option_row > 1 && arcade_mode == FALSE) active_option_row --;
-                   if (active_option_row == 5 && arcade_mode == TRUE) active_option_row = 2;
-                   break;
-               case 1073741905:  // down
-                   if (active_option_row < 5 && arcade_mode == FALSE) active_option_row ++;
-                   if (active_option_row == 2 && arcade_mode == TRUE) active_option_row = 5;
-                   break;
-               case 1073741903:  // right
-                   switch (active_option_row) {
-                     case(1):  // maze option
-                        maze_selected++;
-                        if (maze_selected == 5) maze_selected = 1;
-                        switch_active_mini_map(maze_selected);
-                        break;
-                     case(2):  // arcade mode option
-                       if (arcade_mode == FALSE) {
-                            arcade_mode = TRUE;
-                            maze_selected = 1;
-                            switch_active_mini_map(1);
-                            NUM_GHOSTS = 4;
-                            NUM_PILLS = 12;
-                       } else { arcade_mode = FALSE; }
-                       break;
-                      case(3): // ghosts option
-                        NUM_GHOSTS++;
-                        if (NUM_GHOSTS > 10) NUM_GHOSTS = 10; 
-                        break;
-                      case(4): // pills option
-                        NUM_PILLS++;
-                        if (NUM_PILLS > 99) NUM_PILLS = 99; 
-                        break;
-                      case(5): // start option
-                        sprintf(title_string, "Munchkin - maze: %d - ghosts: %d - pills: %d"
-                               ,maze_selected, NUM_GHOSTS, NUM_PILLS);
-                        SDL_SetWindowTitle(gWindow, title_string);  
-                        done = TRUE;
-                        break;
-                   }  // end switch option row
-                   break;
-              case 1073741904:  // left
-                   switch (active_option_row) {
-                     case(1):  // maze option
-                       maze_selected--;
-                       if (maze_selected == 0) maze_selected = 4;
-                       switch_active_mini_map(maze_selected);
-                       break;
-                     case(2):  // arcade mode option
-                       if (arcade_mode == FALSE) {
-                             arcade_mode = TRUE;
-                            maze_selected = 1;
-                            switch_active_mini_map(1);
-                            NUM_GHOSTS = 4;
-                            NUM_PILLS = 12;
-                       } else { arcade_mode = FALSE; }
-                       break;
-                     case(3): // ghosts option
-                        NUM_GHOSTS--;
-                        if (NUM_GHOSTS < 1) NUM_GHOSTS = 1; 
-                        break;
-                     case(4): // pills option
-                        NUM_PILLS--;
-                        if (NUM_PILLS < 12) NUM_PILLS = 12; 
-                        break;
-                      case(5): // start option
-                        sprintf(title_string, "Munchkin - maze: %d - ghosts: %d - pills: %d"
-                               , maze_selected, NUM_GHOSTS, NUM_PILLS);
-                        SDL_SetWindowTitle(gWindow, title_string);  
-                        done = TRUE;
-                        break;
-                   }  // end switch option row
-                   break;
-              }  // end switch     
+    if (pressed & ACTION_UP) {
+        if (active_option_row > 1 && arcade_mode == FALSE) active_option_row --;
+        if (active_option_row == 5 && arcade_mode == TRUE) active_option_row = 2;
+    }
+    if (pressed & ACTION_DOWN) {
+        if (active_option_row < 5 && arcade_mode == FALSE) active_option_row ++;
+        if (active_option_row == 2 && arcade_mode == TRUE) active_option_row = 5;
+    }
+    if ((pressed & ACTION_RIGHT) && change_option(active_option_row, 1) == TRUE) done = TRUE;
+    if ((pressed & ACTION_LEFT) && change_option(active_option_row, -1) == TRUE) done = TRUE;
 
-           }  // end if arrow keys
+    if (autopilot == TRUE && frame - start_delay == 30*3) {   // --autopilot: arcade game
+        if (arcade_mode == FALSE) change_option(2, 1);
+        done = TRUE;
+    }
 
+    if (done == TRUE) {
+        sprintf(title_string, "Munchkin - maze: %d - ghosts: %d - pills: %d"
+                            , maze_selected, NUM_GHOSTS, NUM_PILLS);
+        SDL_SetWindowTitle(gWindow, title_string);  
+    }
 
-           /* key 8: Toggle full screen */
-           if (key == 56) {     
-             if (full_screen == FALSE) {
-                 // toggle to full screen
-                full_screen = TRUE;
-                toggle_full_screen_mode(full_screen);
-               } else {    // toggle to windowed screen
-                 full_screen = FALSE;
-                 toggle_full_screen_mode(full_screen);
-             }
-           }  // end key = 56 
 
-           if (key == SDLK_ESCAPE)
-              exit(0);
-        }
-      else if (event.type == SDL_QUIT || (event.type == SDL_JOYBUTTONDOWN  && 
-                   (event.jbutton.button == 8 || event.jbutton.button == 7)  ) )   
-                         // close window pressed or home/start button on joystick
-        {
-          exit(0);
-        }
-    }  // end while (SDL_PollEvent(&event))
+    if (title_textures_factor != factor) prerender_title_screen();   // full screen toggled
 
+    // nobody there: the marquee moves on, but only every IDLE_REDRAW frame is drawn
+    idle_tick();
 
     /* draw black screen */
-    SDL_SetRenderDrawColor( gRenderer, 0x0, 0x0, 0x0, 0x0 );
-    SDL_RenderClear(gRenderer);  
+    if (skip_drawing == FALSE) {
+        SDL_SetRenderDrawColor( gRenderer, 0x0, 0x0, 0x0, 0x0 );
+        SDL_RenderClear(gRenderer);  
+    }
     
     frame++;
     if (frame - start_delay >= 20*3) {  
-       x = (VIDEOPAC_RES_W / 2 * factor) - (12*4*factor) + screen_offset_x; 
-       y = y - factor + screen_offset_y;
-       if (y < 15*factor) {
-          y = y + factor;
-          display_instructions(-1 * scroll_x, 145);
+       x = (VIDEOPAC_RES_W / 2) - (12*4); 
+       y = y - 1;
+       if (y < 15) {
+          y = y + 1;
+          display_instructions(scroll_x, 145);
           display_active_option_row(active_option_row);
           scroll_x++;
           if (scroll_x == 269) scroll_x = 0;
        }   
     } else {  
       // wobbly text!
-      x = ( (VIDEOPAC_RES_W / 2 * factor) - (12*4*factor) + (( rand() % 4) - 2)) + screen_offset_x;
-      y = ( (VIDEOPAC_RES_H / 2 * factor) - (5 * factor)  + (( rand() % 4) - 2)) + screen_offset_y;
+      x = (VIDEOPAC_RES_W / 2) - (12*4) + (( rand() % 4) - 2) / (float)SUBPIXELS;
+      y = (VIDEOPAC_RES_H / 2) - 5      + (( rand() % 4) - 2) / (float)SUBPIXELS;
 
     }
     display_select_game(x, y);
 
-    SDL_RenderPresent(gRenderer);    /* update the screen */
+    present_screen();    /* update the screen */
+    TRACE_END(title_frame);
+    finish_deferred_setup(FALSE);     // joysticks after the first frame, join audio thread
 
-    if (SDL_GetTicks() < last_time + 33)
-        SDL_Delay(last_time + 33 - SDL_GetTicks());
+    wait_for_next_frame(last_time);
       
   } // end do
   while (done == FALSE);
+  idle_end();
+
+  // mini-map done, back to the game maze
+  MAZE_OFFSET_X = 9;  MAZE_OFFSET_Y = 23;
+  maze_zoom = SUBPIXELS;
 }
 
 
-void display_select_game(int x, int y)
+void display_select_game(float x, float y)
 {
-  SDL_Color fgColor_green   = {0,182,0};   
-  SDL_Color fgColor_red     = {182,0,0};   
-  SDL_Color fgColor_grey    = {182,182,182};  
-  SDL_Color fgColor_yellow  = {182,182,0};  
-  SDL_Color fgColor_blue    = {0,0,182};  
-  SDL_Color fgColor_magenta = {182,0,182};  
-  SDL_Color fgColor_cyan    = {0,182,182};  
+  SDL_FRect text_position;
+  int w, h;
 
-  SDL_Rect text_position;  
-  char text_line[12];    // SELECT GAME
+  SDL_QueryTexture(select_game_texture, NULL, NULL, &w, &h);
+  text_position.x = x;
+  text_position.y = y;
+  text_position.w = w / (float)factor;
+  text_position.h = h / (float)factor;
+  render_copy_f(select_game_texture, NULL, &text_position);
+}
 
-  sprintf(text_line, "%s", "S       A  ");
-  display_text_line(x, y, "large", text_line, &fgColor_green);
 
-  sprintf(text_line, "%s", " E       M ");
-  display_text_line(x, y, "large", text_line, &fgColor_yellow);
-    
-  sprintf(text_line, "%s", "  L       E");
-  display_text_line(x, y, "large", text_line, &fgColor_blue);
+void display_text_line(float x, float y, char *font_size, char *text_line, SDL_Color *color_text)
+{
+  SDL_FRect text_position;      // in Videopac pixels, text itself is sharp at window resolution
+  TTF_Font * font;
+  text_cache_type * entry;
+  int i;
 
-  sprintf(text_line, "%s", "   E       ");
-  display_text_line(x, y, "large", text_line, &fgColor_magenta);
+  if (font_size == "large")
+     font = font_large;
+  else
+     font = font_small;
+
+  // same text, font and colour as shown before? use that texture
+  entry = NULL;
+  for (i = 0; i < NUM_TEXT_CACHE && entry == NULL; i++) {
+     if (text_cache[i].texture != NULL && text_cache[i].font == font &&
+         text_cache[i].color.r == color_text->r && text_cache[i].color.g == color_text->g &&
+         text_cache[i].color.b == color_text->b && strcmp(text_cache[i].text_line, text_line) == 0)
+        entry = &text_cache[i];
+  }
 
-  sprintf(text_line, "%s", "    C      ");
-  display_text_line(x, y, "large", text_line, &fgColor_cyan);
+  if (entry == NULL) {
+     if (strlen(text_line) >= sizeof(text_cache[0].text_line)) {  // too long for the cache
+        text = TTF_RenderText_Solid(font, text_line, *color_text);
+        if (text == NULL) return;         // empty text has zero width
+        text_texture = SDL_CreateTextureFromSurface( gRenderer, text );
+        textures_created++;
+        text_position.x = x;
+        text_position.y = y;
+        text_position.w = text->w / (float)factor;
+        text_position.h = text->h / (float)factor;
+        render_copy_f(text_texture,  NULL, &text_position);
+        SDL_FreeSurface(text);
+        SDL_DestroyTexture(text_texture);  
+        return;
+     }
 
-  sprintf(text_line, "%s", "     T     ");
-  display_text_line(x, y, "large", text_line, &fgColor_grey);
+     entry = &text_cache[next_text_cache];
+     next_text_cache = (next_text_cache + 1) % NUM_TEXT_CACHE;
+     if (entry->texture != NULL) SDL_DestroyTexture(entry->texture);
+     entry->texture = NULL;
+
+     TRACE_BEGIN(text_texture);
+     text = TTF_RenderText_Solid(font, text_line, *color_text);
+     if (text == NULL) return;            // empty text has zero width
+     entry->texture = SDL_CreateTextureFromSurface( gRenderer, text );
+     textures_created++;
+     TRACE_END(text_texture);
+     entry->w = text->w;
+     entry->h = text->h;
+     entry->font = font;
+     entry->color = *color_text;
+     strcpy(entry->text_line, text_line);
+     SDL_FreeSurface(text);
+  }
 
-  sprintf(text_line, "%s", "       G   ");
-  display_text_line(x, y, "large", text_line, &fgColor_red);
+  text_position.x = x;
+  text_position.y = y;
+  text_position.w = entry->w / (float)factor;
+  text_position.h = entry->h / (float)factor;
+  render_copy_f(entry->texture,  NULL, &text_position);
 }
 
 
-void display_text_line(int x, int y, char *font_size, char *text_line, SDL_Color *color_text)
+void flush_text_cache()       // fonts have changed
 {
-  SDL_Rect text_position;  
+  int i;
 
-  if (font_size == "large")
-     text = TTF_RenderText_Solid(font_large, text_line, *color_text);
-  else
-     text = TTF_RenderText_Solid(font_small, text_line, *color_text);
-   
-  text_texture = SDL_CreateTextureFromSurface( gRenderer, text );
-  text_position.x = x;
-  text_position.y = y;
-  text_position.w = text->w;
-  text_position.h = text->h;
-  SDL_RenderCopy(gRenderer, text_texture,  NULL, &text_position);
-  SDL_FreeSurface(text);
-  SDL_DestroyTexture(text_texture);  
+  for (i = 0; i < NUM_TEXT_CACHE; i++) {
+     if (text_cache[i].texture != NULL) SDL_DestroyTexture(text_cache[i].texture);
+     text_cache[i].texture = NULL;
+  }
+  next_text_cache = 0;
 }
 
 
@@ -3124,321 +4280,412 @@ void display_instructions(int scroll_x, int scroll_y)
   SDL_Color fgColor_cyan    = {0,182,182};  
   int x,y;
 
-  SDL_Rect text_position;  
-  char text_line[240]; 
-  //"        SELECT OPTIONS WITH ARROWS KEYS OR JOYSTICK               SELECT OPTIONS WITH ARROW KEYS OR JOYSTICK "
-
-  sprintf(text_line, "%s", 
-    "          SELECT OPTIONS                                            SELECT OPTIONS                             ");
-  x = scroll_x * factor + screen_offset_x;
-  y = scroll_y * factor + screen_offset_y;
-  display_text_line(x, y, "small", text_line, &fgColor_green);
-
-  sprintf(text_line, "%s", 
-    "                          WITH ARROW KEYS                                           WITH ARROW KEYS            ");
-  x = scroll_x * factor + screen_offset_x;
-  y = scroll_y * factor + screen_offset_y;
-  display_text_line(x, y, "small", text_line, &fgColor_cyan);
-
-  sprintf(text_line, "%s", 
-    "                                          OR JOYSTICK                                               OR JOYSTICK");
-  x = scroll_x * factor + screen_offset_x;
-  y = scroll_y * factor + screen_offset_y;
-  display_text_line(x, y, "small", text_line, &fgColor_magenta);
+  char text_line[40]; 
+  SDL_Rect src;          // part of the marquee that is on screen (window pixels)
+  SDL_FRect rect;        // image desc rectangle 
+  int w, h, k;
+
+  /* scrolling instructions, move the source rect over the wide marquee texture */
+  SDL_QueryTexture(marquee_texture, NULL, NULL, &w, &h);
+  src.x = scroll_x * factor;
+  src.y = 0;
+  src.w = VIDEOPAC_RES_W * factor;
+  src.h = h;
+  if (src.x + src.w > w) src.w = w - src.x;
+  if (src.w > 0) {
+     rect.x = 0;
+     rect.y = scroll_y;
+     rect.w = src.w / (float)factor;
+     rect.h = h / (float)factor;
+     render_copy_f(marquee_texture, &src, &rect);
+  }
 
   if (arcade_mode == TRUE)  sprintf(text_line, "ARCADE MODE  YES");
     else sprintf(text_line, "ARCADE MODE  NO");
-  x = 65 * factor + screen_offset_x;
-  y = 65 * factor + screen_offset_y;
+  x = 65;
+  y = 65;
   display_text_line(x, y, "small", text_line, &fgColor_grey);
 
   sprintf(text_line, "GHOSTS  %02d", NUM_GHOSTS);
-  x = 80 * factor + screen_offset_x;
-  y = 75 * factor + screen_offset_y;
+  x = 80;
+  y = 75;
   if (arcade_mode == FALSE)  display_text_line(x, y, "small", text_line, &fgColor_green);
     else display_text_line(x, y, "small", text_line, &fgColor_blue);
 
   sprintf(text_line, "PILLS   %02d", NUM_PILLS);
-  x = 80 * factor + screen_offset_x;
-  y = 85 * factor + screen_offset_y;
+  x = 80;
+  y = 85;
   if (arcade_mode == FALSE) display_text_line(x, y, "small", text_line, &fgColor_magenta);
     else display_text_line(x, y, "small", text_line, &fgColor_blue);
 
   sprintf(text_line, "%s", "START GAME");
-  x = 80 * factor + screen_offset_x;
-  y = 95 * factor + screen_offset_y;
+  x = 80;
+  y = 95;
   display_text_line(x, y, "small", text_line, &fgColor_cyan);
 
   /*
   sprintf(text_line, "%s", "8 = FULL SCREEN");
-  x = 35 * factor  + screen_offset_x;
-  y = 107 * factor + screen_offset_y;
+  x = 35;
+  y = 107;
   display_text_line(x, y, "small", text_line, &fgColor_red);
 
   sprintf(text_line, "%s", "                  ESC = QUIT");
-  x = 30 * factor  + screen_offset_x;
-  y = 107 * factor + screen_offset_y;
+  x = 30;
+  y = 107;
   display_text_line(x, y, "small", text_line, &fgColor_grey);
   */
 
   sprintf(text_line, "%s", "1 pt       3 pts       10 pts");
-  x = 30 * factor  + screen_offset_x;
-  y = 130 * factor + screen_offset_y;
+  x = 30;
+  y = 130;
   display_text_line(x, y, "small", text_line, &fgColor_yellow);
 
 
-  /* display mini versions of mazes */
-  if (factor != 5 ) {
-      screen_offset_x = 0;
-      screen_offset_y = 18 * factor;
-  }    
-  factor = 1.0; 
-
-  MAZE_OFFSET_X = 9 + 40;  MAZE_OFFSET_Y = 175;
-  //MAZE_OFFSET_X = 9 + 40 + (screen_width / 2) - 496;  MAZE_OFFSET_Y = 175;
-  setup_maze(1);  maze_color = 'y'; 
-  if (maze_selected == 1) { maze_color = 'm'; handle_pills(); draw_pills(); }
-  draw_maze();
-  
-  MAZE_OFFSET_X = 235+9 + 40;  MAZE_OFFSET_Y = 175;
-  //MAZE_OFFSET_X = 9 + 40 + (screen_width / 2) - 496 + 235;  MAZE_OFFSET_Y = 175;
-  setup_maze(2);  maze_color = 'y'; 
-  if (maze_selected == 2) { maze_color = 'm'; handle_pills(); draw_pills(); }
-  draw_maze();
-  
-  MAZE_OFFSET_X = 470+9 + 40;  MAZE_OFFSET_Y = 175;
-  //MAZE_OFFSET_X = 9 + 40 + (screen_width / 2) - 496 + 235 + 235;  MAZE_OFFSET_Y = 175;
-  setup_maze(3);  maze_color = 'y'; 
-  if (maze_selected == 3) { maze_color = 'm'; handle_pills(); draw_pills(); }
-  draw_maze();
-  
-  MAZE_OFFSET_X = 705+9 + 40;  MAZE_OFFSET_Y = 175;
-  //MAZE_OFFSET_X = 9 + 40 + (screen_width / 2) - 496 + 235 + 235 + 235;  MAZE_OFFSET_Y = 175;
-  setup_maze(4);  maze_color = 'y'; 
-  if (maze_selected == 4) { maze_color = 'm'; handle_pills(); draw_pills(); }
-  draw_maze();
-
-  // restore to previous values
-  MAZE_OFFSET_X = 9;  MAZE_OFFSET_Y = 23;
-  factor = (int)round((screen_height / VIDEOPAC_RES_H));
-  screen_offset_x = (screen_width - (screen_height / 4) * 5) / 2;
-  screen_offset_y = 0;
-  
-  // activate mini maze for pills.
-  setup_maze(maze_selected);
-
+  /* display mini versions of mazes, pills of the selected maze move under its lines */
+  handle_pills();
+  draw_pills();
+  for (k = 0; k < 4; k++) {
+     rect.x = (9 + 40 + k*235) / (float)SUBPIXELS;
+     rect.y = 175 / (float)SUBPIXELS;
+     rect.w = MINI_MAP_W / (float)SUBPIXELS;
+     rect.h = MINI_MAP_H / (float)SUBPIXELS;
+     render_copy_f(mini_map_textures[k][(k + 1 == maze_selected)], NULL, &rect);
+  }
 
   /* draw pill, powerpill and ghost */
-  
-  SDL_Rect rect;         // image desc rectangle (w and h are ignored)
 
   // draw pill
-  rect.x =  35 * factor + screen_offset_x;
-  rect.y = 120 * factor + screen_offset_y;
-  rect.w = 3 * factor;   
-  rect.h = 2 * factor;   
-  SDL_RenderCopy(gRenderer, images_textures[74],  NULL, &rect);
+  rect.x =  35;
+  rect.y = 120;
+  rect.w = 3;   
+  rect.h = 2;   
+  render_copy_f(images_textures[74],  NULL, &rect);
 
   // determine next powerpill color
   if (frame % 20 == 0) powerpill_color++;
   if (powerpill_color == 5) powerpill_color = 1;  // wrap 
 
   if (frame % 20 == 0 ) {   // flash pill
-      rect.x =  (89 * factor) + screen_offset_x - 1;     
-      rect.y = (119 * factor) + screen_offset_y - 1;
-      rect.w = 6 * factor;
-      rect.h = 5 * factor;
-      SDL_RenderCopy(gRenderer, images_textures[82 + powerpill_color],  NULL, &rect); // powerpill flash    
+      rect.x =  89 - 1 / (float)SUBPIXELS;     
+      rect.y = 119 - 1 / (float)SUBPIXELS;
+      rect.w = 6;
+      rect.h = 5;
+      render_copy_f(images_textures[82 + powerpill_color],  NULL, &rect); // powerpill flash    
   } else {
-      rect.x =  90 * factor + screen_offset_x;     
-      rect.y = 120 * factor + screen_offset_y;
-      rect.w = 3 * factor;   
-      rect.h = 2 * factor;   
-      SDL_RenderCopy(gRenderer, images_textures[78 + powerpill_color],  NULL, &rect); 
+      rect.x =  90;     
+      rect.y = 120;
+      rect.w = 3;   
+      rect.h = 2;   
+      render_copy_f(images_textures[78 + powerpill_color],  NULL, &rect); 
   }       
 
   // draw ghost
 
-  rect.x = 145 * factor + screen_offset_x;
-  rect.y = 120 * factor + screen_offset_y;
-  rect.w = 8 * factor; 
-  rect.h = 8 * factor; 
+  rect.x = 145;
+  rect.y = 120;
+  rect.w = 8; 
+  rect.h = 8; 
       
   if (frame % 6 >= 0 && frame % 6 <=2 )   // move "feet" of ghosts every 6 frames
-      SDL_RenderCopy(gRenderer, images_textures[((3) * 8) + 87],  NULL, &rect);
+      render_copy_f(images_textures[((3) * 8) + 87],  NULL, &rect);
   else
-      SDL_RenderCopy(gRenderer, images_textures[((3) * 8) + 87 + 1],  NULL, &rect);
+      render_copy_f(images_textures[((3) * 8) + 87 + 1],  NULL, &rect);
 }  
 
 
 void switch_active_mini_map(int maze_selected)
 {
-   factor = 1.0;
-   switch (maze_selected) { 
-    case 1:
-       MAZE_OFFSET_X = 9 + 40;  MAZE_OFFSET_Y = 175;
-       break;
-    case 2:
-       MAZE_OFFSET_X = 235+9 + 40;  MAZE_OFFSET_Y = 175;
-       break;
-    case 3:
-       MAZE_OFFSET_X = 470+9 + 40;  MAZE_OFFSET_Y = 175;
-       break;
-    case 4:
-       MAZE_OFFSET_X = 705+9 + 40;  MAZE_OFFSET_Y = 175;
-       break;
-   } // end switch maze selected
-
+   // pills move in the selected mini-map (1/5 size) until title_screen() ends
+   maze_zoom = 1;
+   MAZE_OFFSET_X = 9 + 40 + (maze_selected - 1) * 235;
+   MAZE_OFFSET_Y = 175;
+   setup_maze(maze_selected);
    setup_pills();  
+}
+
+
+void prerender_title_screen()
+{
+  SDL_Color colors[7];
+  char *text_lines[7];
+  int k, c, keep_center_open, keep_maze_selected, keep_frame;
+  char keep_maze_color;
+
+  SDL_Color fgColor_green   = {0,182,0};   
+  SDL_Color fgColor_red     = {182,0,0};   
+  SDL_Color fgColor_grey    = {182,182,182};  
+  SDL_Color fgColor_yellow  = {182,182,0};  
+  SDL_Color fgColor_blue    = {0,0,182};  
+  SDL_Color fgColor_magenta = {182,0,182};  
+  SDL_Color fgColor_cyan    = {0,182,182};  
+  TRACE_BEGIN(prerender_title_screen);
+
+  /* the 4 mazes in yellow and magenta, 1 texture pixel per maze pixel (5 per Videopac pixel) */
+  if (mini_map_textures[0][0] == NULL) {
+     keep_center_open = maze_center_open;
+     keep_maze_selected = maze_selected;
+     keep_maze_color = maze_color;
+     keep_frame = frame;
+     frame = 1;                        // no center rotation in draw_maze()
+     maze_zoom = SUBPIXELS;
+     MAZE_OFFSET_X = 0;  MAZE_OFFSET_Y = 0;
+     maze_center_open = DOWN;
+
+     for (k = 0; k < 4; k++) {
+        for (c = 0; c < 2; c++) {
+           mini_map_textures[k][c] = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_RGBA8888,
+                                        SDL_TEXTUREACCESS_TARGET, MINI_MAP_W, MINI_MAP_H);
+           if (mini_map_textures[k][c] == NULL) {
+              fprintf(stderr, "Cannot create mini-map texture: %s\n", SDL_GetError());
+              exit(1);
+           }
+           SDL_SetTextureBlendMode(mini_map_textures[k][c], SDL_BLENDMODE_BLEND);
+           SDL_SetRenderTarget(gRenderer, mini_map_textures[k][c]);
+           SDL_SetRenderDrawColor(gRenderer, 0x0, 0x0, 0x0, 0x0);
+           SDL_RenderClear(gRenderer);
+           maze_selected = k + 1;
+           setup_maze(k + 1);
+           if (c == 0) maze_color = 'y';
+             else maze_color = 'm';
+           draw_maze();
+        }
+     }
+     SDL_SetRenderTarget(gRenderer, NULL);    // back to the window (and its logical size)
 
-   // back to actual values
-   MAZE_OFFSET_X = 9;  MAZE_OFFSET_Y = 23;
-   factor = (int)round((screen_height / VIDEOPAC_RES_H));
+     maze_center_open = keep_center_open;
+     maze_selected = keep_maze_selected;
+     maze_color = keep_maze_color;
+     frame = keep_frame;
+     MAZE_OFFSET_X = 9;  MAZE_OFFSET_Y = 23;
+  }
+
+  /* text is made at window resolution, so again when the factor changes */
+  if (marquee_texture != NULL) SDL_DestroyTexture(marquee_texture);
+  if (select_game_texture != NULL) SDL_DestroyTexture(select_game_texture);
+
+  text_lines[0] = "          SELECT OPTIONS                                            SELECT OPTIONS                             ";
+  text_lines[1] = "                          WITH ARROW KEYS                                           WITH ARROW KEYS            ";
+  text_lines[2] = "                                          OR JOYSTICK                                               OR JOYSTICK";
+  colors[0] = fgColor_green;  colors[1] = fgColor_cyan;  colors[2] = fgColor_magenta;
+  // only scroll positions 0..268 plus a screen width are ever shown
+  marquee_texture = render_text_layers("small", 3, text_lines, colors, 
+                                       (269 + VIDEOPAC_RES_W) * factor);
+
+  text_lines[0] = "S       A  ";  colors[0] = fgColor_green;
+  text_lines[1] = " E       M ";  colors[1] = fgColor_yellow;
+  text_lines[2] = "  L       E";  colors[2] = fgColor_blue;
+  text_lines[3] = "   E       ";  colors[3] = fgColor_magenta;
+  text_lines[4] = "    C      ";  colors[4] = fgColor_cyan;
+  text_lines[5] = "     T     ";  colors[5] = fgColor_grey;
+  text_lines[6] = "       G   ";  colors[6] = fgColor_red;
+  select_game_texture = render_text_layers("large", 7, text_lines, colors, 0);
+
+  title_textures_factor = factor;
+  TRACE_END(prerender_title_screen);
+}
+
+
+SDL_Texture * render_text_layers(char *font_size, int num_layers, char *text_lines[],
+                                 SDL_Color colors[], int max_width)
+{
+  // text lines on top of each other in 1 texture, max_width 0 is as wide as the first line
+  SDL_Surface * layers;
+  SDL_Texture * texture;
+  SDL_RendererInfo info;
+  TTF_Font * font;
+  int i, w;
+
+  if (strcmp(font_size, "large") == 0)
+     font = font_large;
+  else
+     font = font_small;
+
+  SDL_GetRendererInfo(gRenderer, &info);
+
+  layers = NULL;
+  for (i = 0; i < num_layers; i++) {
+     text = TTF_RenderText_Solid(font, text_lines[i], colors[i]);
+     if (layers == NULL) {    
+        w = text->w;
+        if (max_width > 0 && w > max_width) w = max_width;
+        if (info.max_texture_width > 0 && w > info.max_texture_width) w = info.max_texture_width;
+        layers = SDL_CreateRGBSurfaceWithFormat(0, w, text->h, 32, SDL_PIXELFORMAT_RGBA8888);
+        SDL_FillRect(layers, NULL, 0);     // transparent
+     }
+     SDL_BlitSurface(text, NULL, layers, NULL);    // background of text is transparent
+     SDL_FreeSurface(text);
+  }
+
+  texture = SDL_CreateTextureFromSurface(gRenderer, layers);
+  textures_created++;
+  SDL_FreeSurface(layers);
+  return texture;
 }
 
 
 void display_active_option_row(int row)
 {
-  SDL_Rect rect;         // image desc rectangle (w and h are ignored)
+  SDL_FRect rect;        // image desc rectangle
 
   switch (row) {
     case 1:   // highlight "maze" option row
-      rect.x = 1 * factor + screen_offset_x;
-      rect.y = 36 * factor + screen_offset_y;
-      rect.w = 2 * factor;
-      rect.h = VERT_LINE_SIZE * factor;  
+      rect.x = 1;
+      rect.y = 36;
+      rect.w = 2;
+      rect.h = VERT_LINE_SIZE;  
       if (frame % 20 >= 0 && frame % 20 < 10) {
-          SDL_RenderCopy(gRenderer, images_textures[1],  NULL, &rect);
-          rect.x = 195 * factor + screen_offset_x;
-          SDL_RenderCopy(gRenderer, images_textures[1],  NULL, &rect);
-          //printf("in display_option: factor=%d screen_offset_x=%d\n ", factor,screen_offset_x);
+          render_copy_f(images_textures[1],  NULL, &rect);
+          rect.x = 195;
+          render_copy_f(images_textures[1],  NULL, &rect);
       } else {
-          SDL_RenderCopy(gRenderer, images_textures[78],  NULL, &rect);
-          rect.x = 195 * factor + screen_offset_x;
-          SDL_RenderCopy(gRenderer, images_textures[78],  NULL, &rect);
+          render_copy_f(images_textures[78],  NULL, &rect);
+          rect.x = 195;
+          render_copy_f(images_textures[78],  NULL, &rect);
       }
       break; 
     case 2: // highlight "arcade mode" option row
-      rect.x = 58 * factor + screen_offset_x;
-      rect.y = (65 * factor) + 2 + screen_offset_y;
-      rect.w = 2 * factor;   
-      rect.h = 6 * factor;  
+      rect.x = 58;
+      rect.y = 65 + 2 / (float)SUBPIXELS;
+      rect.w = 2;   
+      rect.h = 6;  
       if (frame % 20 >= 0 && frame % 20 < 10) {
-          SDL_RenderCopy(gRenderer, images_textures[1],  NULL, &rect);
-          rect.x = 144 * factor + screen_offset_x;
-          SDL_RenderCopy(gRenderer, images_textures[1],  NULL, &rect);
+          render_copy_f(images_textures[1],  NULL, &rect);
+          rect.x = 144;
+          render_copy_f(images_textures[1],  NULL, &rect);
       } else {
-          SDL_RenderCopy(gRenderer, images_textures[78],  NULL, &rect);
-          rect.x = 144 * factor + screen_offset_x;
-          SDL_RenderCopy(gRenderer, images_textures[78],  NULL, &rect);
+          render_copy_f(images_textures[78],  NULL, &rect);
+          rect.x = 144;
+          render_copy_f(images_textures[78],  NULL, &rect);
       }
       break;         
     case 3: // highlight "ghosts" option row
-      rect.x = 70 * factor + screen_offset_x;
-      rect.y = (75 * factor) + 2 + screen_offset_y;
-      rect.w = 2 * factor;   
-      rect.h = 6 * factor;  
+      rect.x = 70;
+      rect.y = 75 + 2 / (float)SUBPIXELS;
+      rect.w = 2;   
+      rect.h = 6;  
       if (frame % 20 >= 0 && frame % 20 < 10) {
-          SDL_RenderCopy(gRenderer, images_textures[1],  NULL, &rect);
-          rect.x = 132 * factor + screen_offset_x;
-          SDL_RenderCopy(gRenderer, images_textures[1],  NULL, &rect);
+          render_copy_f(images_textures[1],  NULL, &rect);
+          rect.x = 132;
+          render_copy_f(images_textures[1],  NULL, &rect);
       } else {
-          SDL_RenderCopy(gRenderer, images_textures[78],  NULL, &rect);
-          rect.x = 132 * factor + screen_offset_x;
-          SDL_RenderCopy(gRenderer, images_textures[78],  NULL, &rect);
+          render_copy_f(images_textures[78],  NULL, &rect);
+          rect.x = 132;
+          render_copy_f(images_textures[78],  NULL, &rect);
       }
       break;         
     case 4: // highlight "pills" option row
-      rect.x = 70 * factor + screen_offset_x;
-      rect.y = (85 * factor) + 2 + screen_offset_y;
-      rect.w = 2 * factor;   
-      rect.h = 6 * factor;  
+      rect.x = 70;
+      rect.y = 85 + 2 / (float)SUBPIXELS;
+      rect.w = 2;   
+      rect.h = 6;  
       if (frame % 20 >= 0 && frame % 20 < 10) {
-          SDL_RenderCopy(gRenderer, images_textures[1],  NULL, &rect);
-          rect.x = 132 * factor + screen_offset_x;
-          SDL_RenderCopy(gRenderer, images_textures[1],  NULL, &rect);
+          render_copy_f(images_textures[1],  NULL, &rect);
+          rect.x = 132;
+          render_copy_f(images_textures[1],  NULL, &rect);
       } else {
-          SDL_RenderCopy(gRenderer, images_textures[78],  NULL, &rect);
-          rect.x = 132 * factor + screen_offset_x;
-          SDL_RenderCopy(gRenderer, images_textures[78],  NULL, &rect);
+          render_copy_f(images_textures[78],  NULL, &rect);
+          rect.x = 132;
+          render_copy_f(images_textures[78],  NULL, &rect);
       }
       break;               
     case 5: // highlight "start game" option row
-      rect.x = 70 * factor + screen_offset_x;
-      rect.y = (95 * factor) + 2 + screen_offset_y;
-      rect.w = 2 * factor;   
-      rect.h = 6 * factor;  
+      rect.x = 70;
+      rect.y = 95 + 2 / (float)SUBPIXELS;
+      rect.w = 2;   
+      rect.h = 6;  
 
       if (frame % 20 >= 0 && frame % 20 < 10) {
-          SDL_RenderCopy(gRenderer, images_textures[1],  NULL, &rect);
-          rect.x = 132 * factor + screen_offset_x;
-          SDL_RenderCopy(gRenderer, images_textures[1],  NULL, &rect);
+          render_copy_f(images_textures[1],  NULL, &rect);
+          rect.x = 132;
+          render_copy_f(images_textures[1],  NULL, &rect);
       } else {
-          SDL_RenderCopy(gRenderer, images_textures[78],  NULL, &rect);
-          rect.x = 132 * factor + screen_offset_x;
-          SDL_RenderCopy(gRenderer, images_textures[78],  NULL, &rect);
+          render_copy_f(images_textures[78],  NULL, &rect);
+          rect.x = 132;
+          render_copy_f(images_textures[78],  NULL, &rect);
       }
       break;               
   }  // end switch
 }
 
 
+int change_option(int row, int step)    // title screen option row, step 1 right -1 left; TRUE: start
+{
+  switch (row) {
+    case(1):  // maze option
+      maze_selected += step;
+      if (maze_selected == 5) maze_selected = 1;
+      if (maze_selected == 0) maze_selected = 4;
+      switch_active_mini_map(maze_selected);
+      break;
+    case(2):  // arcade mode option
+      if (arcade_mode == FALSE) {
+          arcade_mode = TRUE;
+          maze_selected = 1;
+          switch_active_mini_map(1);
+          NUM_GHOSTS = 4;
+          NUM_PILLS = 12;
+      } else { arcade_mode = FALSE; }
+      break;
+    case(3): // ghosts option
+      NUM_GHOSTS += step;
+      if (NUM_GHOSTS > 10) NUM_GHOSTS = 10; 
+      if (NUM_GHOSTS < 1) NUM_GHOSTS = 1; 
+      break;
+    case(4): // pills option
+      NUM_PILLS += step;
+      if (NUM_PILLS > 99) NUM_PILLS = 99; 
+      if (NUM_PILLS < 12) NUM_PILLS = 12; 
+      break;
+    case(5): // start option
+      return(TRUE);
+  }
+  return(FALSE);
+}
+
+
 void wait_for_no_left_right_event()
 {
   SDL_Event event;
-  const Uint8 *keystate = SDL_GetKeyboardState(NULL);
-  
-  do {
-    SDL_PollEvent(&event);
-    const Uint8 *keystate = SDL_GetKeyboardState(NULL);
-
-      if (event.type == SDL_JOYAXISMOTION ) {  
-        // check if joystick 0 has moved
-        if ( event.jaxis.which == 0 ) {
-            //If the X axis changed
-            if ( event.jaxis.axis == 0 ) {
-                //If the X axis is neutral
-                if ( ( event.jaxis.value > -8000 ) && ( event.jaxis.value < 8000 ) ) {
-                     joy_left = 0;
-                     joy_right = 0;
-                } else {
-                    //Adjust the velocity
-                    if ( event.jaxis.value < 0 ) {
-                        joy_left = 1;
-                        joy_right = 0;
-                    } else {
-                        joy_left = 0;
-                        joy_right = 1;
-                    }
-                }
-            }
-            //If the Y axis changed
-            else if ( event.jaxis.axis == 1 ) {
-                //If the Y axis is neutral
-                if ( ( event.jaxis.value > -8000 ) && ( event.jaxis.value < 8000 ) ) {
-                     joy_up = 0;
-                     joy_down = 0;
-                } else {
-                    //Adjust the velocity
-                    if ( event.jaxis.value < 0 ) {
-                     joy_up = 1;
-                     joy_down = 0;
-                    } else {
-                        joy_up = 0;
-                        joy_down = 1;
-                    }
-                }
-            }
-        }   // if event.jaxis.which == 0   
-      }  // event.type == SDL_JOYAXISMOTION
-
-      if (last_joystick_action == TRUE &&
-            joy_up == 0 && joy_down == 0 && joy_left == 0 && joy_right == 0 ) {        
-            last_joystick_action = FALSE;
-      }
 
-  }  
-  while ( keystate[SDL_SCANCODE_LEFT] == 1 || keystate[SDL_SCANCODE_RIGHT] == 1 || last_joystick_action == TRUE); 
+  while (SDL_PollEvent(&event)) ;            // input_watch() sees them
+  input_tick();
+  while (input_held & (ACTION_LEFT | ACTION_RIGHT)) {
+    SDL_WaitEventTimeout(&event, 100);         // sleep until something happens
+    while (SDL_PollEvent(&event)) ;
+    input_tick();
+  }
+}
+
+
+void idle_tick()               // title screen and intermission frames, after input_tick()
+{
+  // a capture or test gets every frame
+  idle = (SDL_GetTicks() - last_input_time >= IDLE_TICKS &&
+          headless == FALSE && capture_file == NULL && golden_dir == NULL);
+  idle_skip = (idle == TRUE && frame % IDLE_REDRAW != 0);
+  skip_drawing = idle_skip;
+}
+
+
+void idle_end()                // back to the game: every frame drawn and waited for
+{
+  idle = FALSE;
+  idle_skip = FALSE;
+  skip_drawing = FALSE;
+}
+
+
+void pause_while_inactive()    // every frame: no frames while the window has no focus
+{
+  SDL_Event event;
+
+  if (window_active == TRUE || headless == TRUE || autopilot == TRUE) return;    // soak runs go on
+
+  SDL_AtomicSet(&audio_paused, TRUE);
+  while (window_active == FALSE)               // input_watch() sees the window events
+      if (SDL_WaitEventTimeout(&event, 1000) && event.type == SDL_QUIT) exit(0);
+  SDL_AtomicSet(&audio_paused, FALSE);
+  input_tick();                                // forget what happened while away
 }
 
 void intermission1()
@@ -3446,9 +4693,8 @@ void intermission1()
   int i, done, x, y, ux, uy, window_size_changed, scroll_x;
   //int munchkin_intermission_direction;
   char text_hori_line[NUM_HORI_CELLS + 1];    
-  Uint32 last_time;
+  Uint32 last_time, pressed;
   SDL_Event event;
-  SDL_Keycode key;
   char title_string[100];
 
   /* title screen loop */
@@ -3485,50 +4731,41 @@ void intermission1()
    } 
 
    setup_maze(5);
-   play_sound(18, 0); // intermission music
+   start_music(18); // intermission music
 
   do
   {
+    pause_while_inactive();
     last_time = SDL_GetTicks();
+    TRACE_BEGIN(intermission1_frame);
       
     /* Check for key presses and joystick actions */
     while (SDL_PollEvent(&event))
     {
-      if (event.type == SDL_KEYDOWN) {
-          key = event.key.keysym.sym;
-          
-           if (key == 1073742048 || key == 49) {  // Button 1 or Left Ctrl pressed
-                sprintf(title_string, "Munchkin - maze: %d - ghosts: %d - pills: %d"
-                                    , maze_selected, NUM_GHOSTS, NUM_PILLS);
-                SDL_SetWindowTitle(gWindow, title_string);  
-                done = TRUE;            
-           } 
-
-           /* key 8: Toggle full screen */
-           if (key == 56) {     
-             if (full_screen == FALSE) {
-                 // toggle to full screen
-                full_screen = TRUE;
-                toggle_full_screen_mode(full_screen);
-               } else {    // toggle to windowed screen
-                 full_screen = FALSE;
-                 toggle_full_screen_mode(full_screen);
-             }
-           }  // end key = 56 
+      if (event.type == SDL_QUIT) exit(0);     // close window pressed
+    }
+    pressed = input_tick();                    // keys and joystick, see input_watch()
 
-           if (key == SDLK_ESCAPE)
-              exit(0);
-        }
-      else if (event.type == SDL_QUIT || (event.type == SDL_JOYBUTTONDOWN  && event.jbutton.button == 8) )   
-                         // close window pressed or home button on joystick
-        {
-          exit(0);
-        }
-    }  // end while (SDL_PollEvent(&event))
+    if (pressed & ACTION_QUIT) exit(0);        // escape, home button on joystick
+
+    if (pressed & ACTION_FULL_SCREEN) {        // key 8: toggle full screen
+        full_screen = !full_screen;
+        toggle_full_screen_mode(full_screen);
+    }
+
+    if (pressed & ACTION_SKIP) {               // 1 or Left Ctrl: skip intermission
+        sprintf(title_string, "Munchkin - maze: %d - ghosts: %d - pills: %d"
+                            , maze_selected, NUM_GHOSTS, NUM_PILLS);
+        SDL_SetWindowTitle(gWindow, title_string);  
+        done = TRUE;            
+    }
+    idle_tick();                               // nobody there: only every IDLE_REDRAW frame
 
     /* draw black screen */
-    SDL_SetRenderDrawColor( gRenderer, 0x0, 0x0, 0x0, 0x0 );
-    SDL_RenderClear(gRenderer);  
+    if (skip_drawing == FALSE) {
+        SDL_SetRenderDrawColor( gRenderer, 0x0, 0x0, 0x0, 0x0 );
+        SDL_RenderClear(gRenderer);  
+    }
     
     frame++;
 
@@ -3570,7 +4807,7 @@ void intermission1()
         for (i = 0; i < NUM_GHOSTS; i++)  {
            ghosts[i].status = 3;
            ghosts[i].speed = 0;
-           play_sound(15,5);  // plop
+           play_sound(15);  // plop
         }
     }
 
@@ -3584,14 +4821,15 @@ void intermission1()
     if (frame - start_delay == 375) done = TRUE;   
 
     //draw_maze(); // debug, NB center will be active
-    SDL_RenderPresent(gRenderer);    /* update the screen */
+    present_screen();    /* update the screen */
+    TRACE_END(intermission1_frame);
 
-    if (SDL_GetTicks() < last_time + 33)
-        SDL_Delay(last_time + 33 - SDL_GetTicks());
+    wait_for_next_frame(last_time);
     
   } // end do
 
   while (done == FALSE);
+  idle_end();
 }
 
 
@@ -3608,13 +4846,13 @@ void display_intermission1_text()
   char text_line[240]; 
   
   sprintf(text_line, "%s", "ACT 1");
-  x = 35 * factor  + screen_offset_x;
-  y = 20 * factor  + screen_offset_y;
+  x = 35;
+  y = 20;
   display_text_line(x, y, "small", text_line, &fgColor_yellow);
 
   sprintf(text_line, "%s", "                   THE CHASE ");
-  x = 35 * factor  + screen_offset_x;
-  y = 20 * factor  + screen_offset_y;
+  x = 35;
+  y = 20;
   display_text_line(x, y, "small", text_line, &fgColor_magenta);
 }  
 
@@ -3624,11 +4862,10 @@ void intermission2()
   int i, done, x, y, ux, uy, window_size_changed, scroll_x;
   //int munchkin_intermission_direction;
   char text_hori_line[NUM_HORI_CELLS + 1];    
-  Uint32 last_time;
+  Uint32 last_time, pressed;
   SDL_Event event;
-  SDL_Keycode key;
   char title_string[100];
-  SDL_Rect rect;         // powerpill
+  SDL_FRect rect;        // powerpill
   powerpill_color = 1;
 
 
@@ -3707,50 +4944,41 @@ void intermission2()
    } 
 
    setup_maze(6);
-   play_sound(19, 0); // intermission music
+   start_music(19); // intermission music
 
   do
   {
+    pause_while_inactive();
     last_time = SDL_GetTicks();
+    TRACE_BEGIN(intermission2_frame);
       
     /* Check for key presses and joystick actions */
     while (SDL_PollEvent(&event))
     {
-      if (event.type == SDL_KEYDOWN) {
-          key = event.key.keysym.sym;
-          
-           if (key == 1073742048 || key == 49) {  // Button 1 or Left Ctrl pressed
-                sprintf(title_string, "Munchkin - maze: %d - ghosts: %d - pills: %d"
-                                    , maze_selected, NUM_GHOSTS, NUM_PILLS);
-                SDL_SetWindowTitle(gWindow, title_string);  
-                done = TRUE;            
-           } 
-
-           /* key 8: Toggle full screen */
-           if (key == 56) {     
-             if (full_screen == FALSE) {
-                 // toggle to full screen
-                full_screen = TRUE;
-                toggle_full_screen_mode(full_screen);
-               } else {    // toggle to windowed screen
-                 full_screen = FALSE;
-                 toggle_full_screen_mode(full_screen);
-             }
-           }  // end key = 56 
+      if (event.type == SDL_QUIT) exit(0);     // close window pressed
+    }
+    pressed = input_tick();                    // keys and joystick, see input_watch()
 
-           if (key == SDLK_ESCAPE)
-              exit(0);
-        }
-      else if (event.type == SDL_QUIT || (event.type == SDL_JOYBUTTONDOWN  && event.jbutton.button == 8) )   
-                         // close window pressed or home button on joystick
-        {
-          exit(0);
-        }
-    }  // end while (SDL_PollEvent(&event))
+    if (pressed & ACTION_QUIT) exit(0);        // escape, home button on joystick
+
+    if (pressed & ACTION_FULL_SCREEN) {        // key 8: toggle full screen
+        full_screen = !full_screen;
+        toggle_full_screen_mode(full_screen);
+    }
+
+    if (pressed & ACTION_SKIP) {               // 1 or Left Ctrl: skip intermission
+        sprintf(title_string, "Munchkin - maze: %d - ghosts: %d - pills: %d"
+                            , maze_selected, NUM_GHOSTS, NUM_PILLS);
+        SDL_SetWindowTitle(gWindow, title_string);  
+        done = TRUE;            
+    }
+    idle_tick();                               // nobody there: only every IDLE_REDRAW frame
 
     /* draw black screen */
-    SDL_SetRenderDrawColor( gRenderer, 0x0, 0x0, 0x0, 0x0 );
-    SDL_RenderClear(gRenderer);  
+    if (skip_drawing == FALSE) {
+        SDL_SetRenderDrawColor( gRenderer, 0x0, 0x0, 0x0, 0x0 );
+        SDL_RenderClear(gRenderer);  
+    }
     
     frame++;
 
@@ -3786,7 +5014,7 @@ void intermission2()
  
     /* munchkin eats powerpill */
     if (frame - start_delay == 242) {    
-        play_sound(14,4);  // eat pill
+        play_sound(14);  // eat pill
         munchkin_auto_direction  = LEFT;   
         munchkin_last_direction  = LEFT;  
 
@@ -3816,29 +5044,30 @@ void intermission2()
         if (powerpill_color == 5) powerpill_color = 1;  // wrap 
 
         if (frame % 20 == 0 ) {   // flash pill
-            rect.x =  (190 * factor) + screen_offset_x - 1;
-            rect.y =  (71 * factor) + screen_offset_y - 1;     
-            rect.w = 6 * factor;
-            rect.h = 5 * factor;
-            SDL_RenderCopy(gRenderer, images_textures[82 + powerpill_color],  NULL, &rect); // powerpill flash    
+            rect.x =  190 - 1 / (float)SUBPIXELS;
+            rect.y =   71 - 1 / (float)SUBPIXELS;     
+            rect.w = 6;
+            rect.h = 5;
+            render_copy_f(images_textures[82 + powerpill_color],  NULL, &rect); // powerpill flash    
         } else {
-            rect.x =  191 * factor + screen_offset_x;
-            rect.y =  72 * factor + screen_offset_y;     
-            rect.w = 3 * factor;   
-            rect.h = 2 * factor;   
-            SDL_RenderCopy(gRenderer, images_textures[78 + powerpill_color],  NULL, &rect); 
+            rect.x =  191;
+            rect.y =   72;     
+            rect.w = 3;   
+            rect.h = 2;   
+            render_copy_f(images_textures[78 + powerpill_color],  NULL, &rect); 
         }       
     }  // frame - start_delay <= 245
 
     //draw_maze(); // optional for debug
-    SDL_RenderPresent(gRenderer);    /* update the screen */
+    present_screen();    /* update the screen */
+    TRACE_END(intermission2_frame);
 
-    if (SDL_GetTicks() < last_time + 33)
-        SDL_Delay(last_time + 33 - SDL_GetTicks());
+    wait_for_next_frame(last_time);
     
   } // end do
 
   while (done == FALSE);
+  idle_end();
 }
 
 
@@ -3855,14 +5084,2162 @@ void display_intermission2_text()
   char text_line[240]; 
   
   sprintf(text_line, "%s", "ACT 2");
-  x = 35 * factor  + screen_offset_x;
-  y = 15 * factor  + screen_offset_y;
+  x = 35;
+  y = 15;
   display_text_line(x, y, "small", text_line, &fgColor_yellow);
 
   sprintf(text_line, "%s", "                   THE HUNT");
-  x = 35 * factor  + screen_offset_x;
-  y = 15 * factor  + screen_offset_y;
+  x = 35;
+  y = 15;
   display_text_line(x, y, "small", text_line, &fgColor_magenta);
 }  
 
+
+#define ____________a
+#define ___ASSETS___b
+#define ____________c
+
+/* ---------------------------------------------------------------------
+   -   Asset decoding on worker threads at startup                     -
+   -   SDL_LoadBMP, conversion and WAV resampling run in parallel,     -
+   -   textures are made on the main thread only                       -
+   --------------------------------------------------------------------- */
+
+void start_asset_workers()
+{
+  int i;
+
+  num_asset_workers = SDL_GetCPUCount();
+  if (num_asset_workers > MAX_ASSET_WORKERS) num_asset_workers = MAX_ASSET_WORKERS;
+
+  SDL_AtomicSet(&next_asset_job, 0);
+  for (i = 0; i < NUM_ASSET_JOBS; i++) {
+      SDL_AtomicSet(&asset_job_done[i], FALSE);
+      asset_job_finished[i] = SDL_CreateSemaphore(0);
+      if (asset_job_finished[i] == NULL) {
+          num_asset_workers = 0;                // load_images() and setup() decode themselves
+          destroy_asset_semaphores();
+          return;
+      }
+  }
+
+  for (i = 0; i < num_asset_workers; i++) {
+      asset_workers[i] = SDL_CreateThread(asset_worker, "assets", NULL);
+      if (asset_workers[i] == NULL) break;
+  }
+  num_asset_workers = i;
+  if (num_asset_workers == 0) {
+      fprintf(stderr, "Cannot start asset threads: %s\n", SDL_GetError());
+      destroy_asset_semaphores();
+  }
+}
+
+
+void destroy_asset_semaphores()
+{
+  int i;
+
+  for (i = 0; i < NUM_ASSET_JOBS; i++) {
+      if (asset_job_finished[i] != NULL) SDL_DestroySemaphore(asset_job_finished[i]);
+      asset_job_finished[i] = NULL;
+  }
+}
+
+
+int asset_worker(void *data)
+{
+  int job, i, audio_checked;
+
+  audio_checked = FALSE;
+
+  // take the next job until all are taken; images first, load_images() needs them first
+  while ((job = SDL_AtomicAdd(&next_asset_job, 1)) < NUM_ASSET_JOBS) {
+      TRACE_BEGIN(decode_asset);
+      if (job < NUM_IMAGES) {
+          if (image_used(job)) decoded_images[job] = decode_image(job);
+      } else {
+          i = job - NUM_IMAGES;
+          if (audio_checked == FALSE) {         // sounds are converted for the device format
+              SDL_SemWait(audio_device_opened);
+              audio_checked = TRUE;
+          }
+          if (audio_device_ok && i < FIRST_MUSIC && first_sound_with_name(i) == i && 
+              find_pack_entry(sound_names[i]) == NULL)
+              decoded_sounds[i] = Mix_LoadWAV(sound_names[i]);     // NULL: setup_audio() reports it
+      }
+      TRACE_END(decode_asset);
+      SDL_MemoryBarrierRelease();               // result is visible before the flag
+      SDL_AtomicSet(&asset_job_done[job], TRUE);
+      SDL_SemPost(asset_job_finished[job]);
+  }
+  return(0);
+}
+
+
+void wait_for_asset_job(int job)
+{
+  if (num_asset_workers == 0) return;
+  if (SDL_AtomicGet(&asset_job_done[job]) == FALSE) {
+      SDL_SemWait(asset_job_finished[job]);
+      SDL_SemPost(asset_job_finished[job]);     // main thread and audio thread can both wait
+  }
+  SDL_MemoryBarrierAcquire();
+}
+
+
+void stop_asset_workers()
+{
+  int i;
+
+  if (num_asset_workers == 0) return;
+  for (i = 0; i < num_asset_workers; i++) SDL_WaitThread(asset_workers[i], NULL);
+  destroy_asset_semaphores();
+  num_asset_workers = 0;
+  for (i = 0; i < NUM_IMAGES; i++) {            // not taken by load_images()
+      if (decoded_images[i] != NULL) SDL_FreeSurface(decoded_images[i]);
+      decoded_images[i] = NULL;
+  }
+}
+
+
+void start_deferred_setup()
+{
+  SDL_AtomicSet(&audio_ready, FALSE);
+  SDL_AtomicSet(&audio_setup_done, FALSE);
+  audio_device_opened = SDL_CreateSemaphore(0);
+  if (audio_device_opened == NULL) {
+      fprintf(stderr, "Cannot create semaphore: %s\n", SDL_GetError());
+      exit(1);
+  }
+
+  audio_thread = SDL_CreateThread(setup_audio, "audio setup", NULL);
+  if (audio_thread == NULL) setup_audio(NULL);      // no thread: open it now
+}
+
+
+int setup_audio(void *data)
+{
+  int i;
+
+  /* Open sound */
+
+  TRACE_BEGIN(open_audio);
+  audio_device_ok = TRUE;
+  // the device may use its own rate, then SDL does not resample every buffer;
+  // the sounds are converted to it once when they are loaded
+  if (Mix_OpenAudioDevice(audio_rate, AUDIO_S16, 1, audio_buffer, NULL, 
+                          SDL_AUDIO_ALLOW_FREQUENCY_CHANGE) < 0) {
+         fprintf(stderr,
+          "\nWarning: I could not set up audio for %d Hz "
+          "16-bit mono.\n"
+          "The Simple DirectMedia error that occured was:\n"
+          "%s\n\n", audio_rate, SDL_GetError());
+          audio_device_ok = FALSE;                  // play without sound
+  }
+  for (i = 0; i < MAX_ASSET_WORKERS; i++) SDL_SemPost(audio_device_opened);
+  if (audio_device_ok == FALSE) {
+      SDL_AtomicSet(&audio_setup_done, TRUE);
+      return(0);
+  }
+        
+  vol_effects = 5;
+  vol_music = 5;
+  
+  Mix_Volume(-1, vol_effects * (MIX_MAX_VOLUME / 5));
+  effects_volume = vol_effects * (MIX_MAX_VOLUME / 5);
+  Mix_VolumeMusic(vol_music * (MIX_MAX_VOLUME / 5));
+  music_volume = vol_music * (MIX_MAX_VOLUME / 5);
+
+  Mix_AllocateChannels(0);        // the effects are mixed by audio_post_mix()
+
+  Mix_QuerySpec(&audio_device_rate, NULL, NULL);
+  audio_mix_period = SDL_GetPerformanceFrequency() * audio_buffer / audio_device_rate;
+  SDL_AtomicSet(&mix_silent, TRUE);
+  Mix_SetPostMix(audio_post_mix, NULL);
+  printf("audio %d Hz, buffer %d samples (%.1f ms)\n", audio_device_rate, audio_buffer, 
+         1000.0 * audio_buffer / audio_device_rate);
+  TRACE_END(open_audio);
+
+
+ /* Load sounds */
+      
+ TRACE_BEGIN(load_sounds);
+ for (i = 0; i < FIRST_MUSIC; i++) {               // the music is streamed when it plays
+    sounds[i] = load_sound_from_pack(i);
+    if (sounds[i] == NULL) {
+       wait_for_asset_job(NUM_IMAGES + first_sound_with_name(i));
+       sounds[i] = decoded_sounds[first_sound_with_name(i)];     // dummy.wav is decoded once
+    }
+    if (sounds[i] == NULL) sounds[i] = Mix_LoadWAV(sound_names[i]);
+    if (sounds[i] == NULL)
+      {
+        fprintf(stderr,
+          "\nError: I could not load the sound file:\n"
+          "%s\n"
+          "The Simple DirectMedia error that occured was:\n"
+          "%s\n\n", sound_names[i], SDL_GetError());
+        SDL_AtomicSet(&audio_setup_done, TRUE);     // play without sound
+        return(0);
+      }
+  }  
+  TRACE_END(load_sounds);
+
+  SDL_AtomicSet(&audio_ready, TRUE);
+  SDL_AtomicSet(&audio_setup_done, TRUE);
+  return(0);
+}
+
+
+void finish_deferred_setup(int wait)
+{
+  if (joystick_pending == TRUE) {
+      joystick_pending = FALSE;
+      setup_joystick();
+  }
+
+  // wait = FALSE: only join when the audio thread is done (once per title frame)
+  if (audio_thread != NULL && (wait == TRUE || SDL_AtomicGet(&audio_setup_done) == TRUE)) {
+      SDL_WaitThread(audio_thread, NULL);
+      audio_thread = NULL;
+  }
+  if (audio_thread == NULL && SDL_AtomicGet(&audio_setup_done) == TRUE && audio_device_opened != NULL) {
+      stop_asset_workers();
+      SDL_DestroySemaphore(audio_device_opened);
+      audio_device_opened = NULL;
+  }
+}
+
+
+int first_sound_with_name(int i)
+{
+  int j;
+
+  for (j = 0; j < i; j++)
+      if (strcmp(sound_names[j], sound_names[i]) == 0) return(j);
+  return(i);
+}
+
+
+#define ___________a
+#define ___AUDIO___b
+#define ___________c
+
+/* ---------------------------------------------------------------------
+   -   Audio latency: late buffers and play_sound() to mixed samples   -
+   --------------------------------------------------------------------- */
+
+void audio_post_mix(void *udata, Uint8 *stream, int len)    // audio thread, every buffer
+{
+  Sint16 *samples;
+  Uint64 now, previous_mix_time;
+  int i, n, latency_us;
+
+  if (SDL_AtomicGet(&audio_paused) == TRUE) {   // window inactive: silence, voices wait
+      last_mix_time = 0;
+      return;
+  }
+
+  // SDL does not report underruns; a buffer asked for much later than one period
+  // after the previous one means the device ran dry (or was about to)
+  now = SDL_GetPerformanceCounter();
+  if (last_mix_time != 0 && now - last_mix_time > audio_mix_period * 3 / 2) 
+      SDL_AtomicAdd(&audio_late_buffers, 1);
+  previous_mix_time = last_mix_time;
+  last_mix_time = now;
+
+  samples = (Sint16 *)stream;                  // AUDIO_S16 mono, SDL converts if the device differs
+  n = len / 2;
+  run_audio_commands(samples, n, previous_mix_time);
+  mix_music(samples, n);
+
+  for (i = 0; i < n; i++) if (samples[i] != 0) break;
+  SDL_AtomicSet(&mix_silent, i == n);
+
+  if (i < n && SDL_AtomicGet(&latency_event_pending) == TRUE) {
+      SDL_MemoryBarrierAcquire();
+      // this buffer is heard after the one playing now: one buffer, plus the samples before it
+      latency_us = (now - latency_event_time) * 1000000 / SDL_GetPerformanceFrequency() +
+                   (Sint64)(audio_buffer + i) * 1000000 / audio_device_rate;
+      latency_total_us += latency_us;
+      SDL_AtomicSet(&latency_average_us, latency_total_us / (SDL_AtomicGet(&latency_count) + 1));
+      SDL_AtomicAdd(&latency_count, 1);
+      if (latency_us > SDL_AtomicGet(&latency_max_us)) SDL_AtomicSet(&latency_max_us, latency_us);
+      SDL_AtomicSet(&latency_event_pending, FALSE);
+  }
+}
+
+
+void run_audio_commands(Sint16 *stream, int n, Uint64 previous_mix_time)    // audio thread
+{
+  audio_command_type *command;
+  mix_voice_type *voice;
+  int head, tail, from, to;
+
+  head = SDL_AtomicGet(&audio_command_head);
+  tail = SDL_AtomicGet(&audio_command_tail);
+  SDL_MemoryBarrierAcquire();
+
+  from = 0;
+  for (; tail != head; tail++) {
+      command = &audio_commands[tail & (AUDIO_COMMANDS - 1)];
+
+      // given x ticks after the previous buffer: start x ticks into this one
+      to = 0;
+      if (previous_mix_time != 0 && command->time > previous_mix_time)
+          to = (command->time - previous_mix_time) * n / audio_mix_period;
+      if (to < from) to = from;
+      if (to > n - 1) to = n - 1;
+      mix_voices_range(stream, from, to);
+      from = to;
+
+      voice = &mix_voices[command->voice];
+      if (command->type == AUDIO_PLAY) {
+          voice->samples = (const Sint16 *)sounds[command->sound]->abuf;
+          voice->length = sounds[command->sound]->alen / 2;
+          voice->position = 0;
+          voice->loop = sound_info[command->sound].loop;
+          voice->volume = command->volume;
+          voice->generation = command->generation;
+          if (voice->length == 0) {             // empty sound: done at once
+              voice->samples = NULL;
+              SDL_AtomicCAS(&voice_busy[command->voice], voice->generation, 0);
+          }
+      } else if (command->type == AUDIO_STOP && voice->generation == command->generation) {
+          voice->samples = NULL;
+      }
+  }
+  mix_voices_range(stream, from, n);
+
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicSet(&audio_command_tail, tail);
+}
+
+
+void mix_voices_range(Sint16 *stream, int from, int to)    // audio thread
+{
+  mix_voice_type *voice;
+  int v, i, span;
+
+  for (v = 0; v < NUM_VOICES; v++) {
+      voice = &mix_voices[v];
+      i = from;
+      while (voice->samples != NULL && i < to) {
+          // up to the end of the buffer or of the sound, whichever comes first
+          span = to - i;
+          if (span > voice->length - voice->position) span = voice->length - voice->position;
+          mix_samples(stream + i, voice->samples + voice->position, span, voice->volume);
+          i += span;
+          voice->position += span;
+          if (voice->position == voice->length) {
+              voice->position = 0;
+              if (voice->loop == FALSE) {
+                  voice->samples = NULL;
+                  // free for play_sound(), unless the game already gave the voice a new sound
+                  SDL_AtomicCAS(&voice_busy[v], voice->generation, 0);
+              }
+          }
+      }
+  }
+}
+
+
+void mix_samples(Sint16 *out, const Sint16 *in, int n, int volume)    // out += in * volume / 128
+{
+  int i, sample;
+
+  i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+  {
+    __m128i vol, a, b, lo, hi;
+
+    vol = _mm_set1_epi16(volume);
+    for (; i + 8 <= n; i += 8) {
+        a = _mm_loadu_si128((const __m128i *)(in + i));
+        if (volume != MIX_MAX_VOLUME) {    // 16 x 16 = 32 bit products, / 128, back to 16 bit (saturated)
+            lo = _mm_mullo_epi16(a, vol);
+            hi = _mm_mulhi_epi16(a, vol);
+            a = _mm_packs_epi32(_mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 7),
+                                _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 7));
+        }
+        b = _mm_loadu_si128((const __m128i *)(out + i));
+        _mm_storeu_si128((__m128i *)(out + i), _mm_adds_epi16(a, b));
+    }
+  }
+#elif defined(__ARM_NEON)
+  {
+    int16x8_t a;
+    int16x4_t vol;
+
+    vol = vdup_n_s16(volume);
+    for (; i + 8 <= n; i += 8) {
+        a = vld1q_s16(in + i);
+        if (volume != MIX_MAX_VOLUME)
+            a = vcombine_s16(vqshrn_n_s32(vmull_s16(vget_low_s16(a), vol), 7),
+                             vqshrn_n_s32(vmull_s16(vget_high_s16(a), vol), 7));
+        vst1q_s16(out + i, vqaddq_s16(vld1q_s16(out + i), a));
+    }
+  }
+#endif
+
+  for (; i < n; i++) {                     // rest (or everything without SIMD)
+      sample = out[i] + ((in[i] * volume) >> 7);
+      if (sample > 32767) sample = 32767;
+      if (sample < -32768) sample = -32768;
+      out[i] = sample;
+  }
+}
+
+
+void print_audio_latency()
+{
+  if (audio_device_rate == 0) return;          // no audio
+  printf("audio: %d late buffers, %d sound commands dropped", SDL_AtomicGet(&audio_late_buffers),
+         audio_commands_dropped);
+  if (SDL_AtomicGet(&latency_count) > 0)
+      printf(", play_sound() to output %.1f ms average, %.1f ms max (%d sounds)", 
+             SDL_AtomicGet(&latency_average_us) / 1000.0,
+             SDL_AtomicGet(&latency_max_us) / 1000.0, SDL_AtomicGet(&latency_count));
+  printf("\n");
+}
+
+
+#define ___________a
+#define ___MUSIC___b
+#define ___________c
+
+/* ---------------------------------------------------------------------
+   -   Music: intermission tunes streamed through a ring                -
+   --------------------------------------------------------------------- */
+
+void start_music(int snd)
+{
+  if (SDL_AtomicGet(&audio_ready) == FALSE) return;    // like play_sound()
+  stop_music();
+
+  SDL_AtomicSet(&music_stop, FALSE);
+  music_thread = SDL_CreateThread(music_feeder, "music", (void *)(intptr_t)snd);
+  if (music_thread == NULL) fprintf(stderr, "Cannot start music thread: %s\n", SDL_GetError());
+}
+
+
+void stop_music()
+{
+  if (music_thread == NULL) return;
+  SDL_AtomicSet(&music_stop, TRUE);
+  SDL_WaitThread(music_thread, NULL);        // also when it already ended by itself
+  music_thread = NULL;
+  // the audio thread skips what is left, the next tune is written after it
+  SDL_AtomicSet(&music_flush, SDL_AtomicGet(&music_write));
+}
+
+
+int music_feeder(void *data)    // music thread
+{
+  SDL_RWops *file;
+  SDL_AudioSpec spec;
+  SDL_AudioStream *stream;
+  Uint8 bytes[4096];
+  Sint16 buffer[MUSIC_CHUNK];
+  Uint32 length, n;
+  int snd, write, got, first, end_of_file;
+
+  snd = (intptr_t)data;
+  file = open_music(snd, &spec, &length);
+  if (file == NULL) {
+      fprintf(stderr, "Cannot play %s: %s\n", sound_names[snd], SDL_GetError());
+      return(0);
+  }
+  stream = SDL_NewAudioStream(spec.format, spec.channels, spec.freq, AUDIO_S16SYS, 1, audio_device_rate);
+  if (stream == NULL) {
+      fprintf(stderr, "Cannot convert %s: %s\n", sound_names[snd], SDL_GetError());
+      SDL_RWclose(file);
+      return(0);
+  }
+
+  end_of_file = FALSE;
+  while (SDL_AtomicGet(&music_stop) == FALSE) {
+      write = SDL_AtomicGet(&music_write);
+      if (MUSIC_RING - (write - SDL_AtomicGet(&music_read)) < MUSIC_CHUNK) {
+          SDL_Delay(5);                           // ring full, the audio thread takes 1 buffer at a time
+          continue;
+      }
+
+      got = SDL_AudioStreamGet(stream, buffer, sizeof(buffer)) / 2;
+      if (got <= 0) {                             // converter is empty, read more
+          if (end_of_file == TRUE) break;         // all played (or in the ring)
+          n = SDL_RWread(file, bytes, 1, length < sizeof(bytes) ? length : sizeof(bytes));
+          length -= n;
+          if (n == 0) {
+              end_of_file = TRUE;
+              SDL_AudioStreamFlush(stream);
+          } else if (SDL_AudioStreamPut(stream, bytes, n) < 0) break;
+          continue;
+      }
+
+      first = write & (MUSIC_RING - 1);
+      if (first + got > MUSIC_RING) {
+          memcpy(music_ring + first, buffer, (MUSIC_RING - first) * 2);
+          memcpy(music_ring, buffer + MUSIC_RING - first, (got - MUSIC_RING + first) * 2);
+      } else memcpy(music_ring + first, buffer, got * 2);
+      SDL_MemoryBarrierRelease();                 // samples are in the ring before the audio thread sees them
+      SDL_AtomicSet(&music_write, write + got);
+  }
+
+  SDL_FreeAudioStream(stream);
+  SDL_RWclose(file);
+  return(0);
+}
+
+
+SDL_RWops * open_music(int snd, SDL_AudioSpec *spec, Uint32 *length)    // at the samples
+{
+  const pack_entry_type *entry;
+  SDL_RWops *file;
+  Uint32 id, size;
+  Uint16 bits;
+  int have_format;
+
+  // from the pack: samples in the format of the machine that made it
+  entry = find_pack_entry(sound_names[snd]);
+  if (entry != NULL) {
+      spec->freq = pack_header->audio_frequency;
+      spec->format = pack_header->audio_format;
+      spec->channels = pack_header->audio_channels;
+      *length = entry->size;
+      return(SDL_RWFromConstMem(pack_data + entry->offset, entry->size));
+  }
+
+  // .wav file: find the "fmt " and "data" chunks, PCM 8 or 16 bit only
+  file = SDL_RWFromFile(sound_names[snd], "rb");
+  if (file == NULL) return(NULL);
+  id = SDL_ReadLE32(file);                        // "RIFF" size "WAVE"
+  SDL_ReadLE32(file);
+  if (id != 0x46464952 || SDL_ReadLE32(file) != 0x45564157) {
+      SDL_SetError("not a RIFF WAVE file");
+      SDL_RWclose(file);
+      return(NULL);
+  }
+  have_format = FALSE;
+  while (TRUE) {
+      id = SDL_ReadLE32(file);
+      size = SDL_ReadLE32(file);
+      if (id == 0 || size == 0) {
+          SDL_SetError("no sound data");
+          break;
+      }
+      if (id == 0x20746d66) {                     // "fmt "
+          if (SDL_ReadLE16(file) != 1) {
+              SDL_SetError("not PCM");
+              break;
+          }
+          spec->channels = SDL_ReadLE16(file);
+          spec->freq = SDL_ReadLE32(file);
+          SDL_ReadLE32(file);                     // bytes per second
+          SDL_ReadLE16(file);                     // block align
+          bits = SDL_ReadLE16(file);
+          spec->format = (bits == 8) ? AUDIO_U8 : AUDIO_S16LSB;
+          if (bits != 8 && bits != 16) {
+              SDL_SetError("%d bit samples", bits);
+              break;
+          }
+          have_format = TRUE;
+          SDL_RWseek(file, ((size + 1) & ~1) - 16, RW_SEEK_CUR);
+      } else if (id == 0x61746164) {              // "data"
+          if (have_format == FALSE) {
+              SDL_SetError("data before format");
+              break;
+          }
+          *length = size;
+          return(file);
+      } else SDL_RWseek(file, (size + 1) & ~1, RW_SEEK_CUR);    // chunks are 2 aligned
+  }
+  SDL_RWclose(file);
+  return(NULL);
+}
+
+
+void mix_music(Sint16 *stream, int n)    // audio thread
+{
+  int read, flush, available, first;
+
+  read = SDL_AtomicGet(&music_read);
+  available = SDL_AtomicGet(&music_write) - read;
+  SDL_MemoryBarrierAcquire();
+  flush = SDL_AtomicGet(&music_flush);
+  if (read - flush < 0) {                        // tune was stopped
+      available -= flush - read;
+      read = flush;
+  }
+  if (available > n) available = n;              // less: the tune ends (or the disk is slow)
+
+  first = read & (MUSIC_RING - 1);
+  if (first + available > MUSIC_RING) {
+      mix_samples(stream, music_ring + first, MUSIC_RING - first, music_volume);
+      mix_samples(stream + MUSIC_RING - first, music_ring, available - MUSIC_RING + first, music_volume);
+  } else mix_samples(stream, music_ring + first, available, music_volume);
+
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicSet(&music_read, read + available);
+}
+
+
+#ifdef MUNCHKIN_OWN_MIXER
+#define _______________a
+#define ___OWN_MIXER___b
+#define _______________c
+
+/* ---------------------------------------------------------------------
+   -   Built-in mixer (-DMUNCHKIN_OWN_MIXER) instead of SDL_mixer      -
+   --------------------------------------------------------------------- */
+
+int Mix_OpenAudioDevice(int frequency, Uint16 format, int channels, int chunksize, 
+                        const char *device, int allowed_changes)
+{
+  SDL_AudioSpec want;
+
+  SDL_zero(want);
+  want.freq = frequency;
+  want.format = format;
+  want.channels = channels;
+  want.samples = chunksize;
+  want.callback = own_mixer_callback;
+  own_mixer_device = SDL_OpenAudioDevice(device, 0, &want, &own_mixer_spec, allowed_changes);
+  if (own_mixer_device == 0) return(-1);
+  SDL_PauseAudioDevice(own_mixer_device, 0);
+  return(0);
+}
+
+
+void own_mixer_callback(void *udata, Uint8 *stream, int len)    // audio thread
+{
+  memset(stream, own_mixer_spec.silence, len);
+  if (own_mixer_post_mix != NULL) own_mixer_post_mix(udata, stream, len);
+}
+
+
+int Mix_QuerySpec(int *frequency, Uint16 *format, int *channels)
+{
+  if (own_mixer_device == 0) return(0);
+  if (frequency) *frequency = own_mixer_spec.freq;
+  if (format) *format = own_mixer_spec.format;
+  if (channels) *channels = own_mixer_spec.channels;
+  return(1);
+}
+
+
+void Mix_SetPostMix(void (*mix_func)(void *udata, Uint8 *stream, int len), void *arg)
+{
+  SDL_LockAudioDevice(own_mixer_device);
+  own_mixer_post_mix = mix_func;
+  SDL_UnlockAudioDevice(own_mixer_device);
+}
+
+
+Mix_Chunk * Mix_LoadWAV(const char *file)      // converted to the device format once
+{
+  SDL_AudioSpec spec;
+  SDL_AudioCVT cvt;
+  Mix_Chunk *chunk;
+  Uint8 *buffer;
+  Uint32 length;
+
+  if (own_mixer_device == 0 || SDL_LoadWAV(file, &spec, &buffer, &length) == NULL) return(NULL);
+  if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq, own_mixer_spec.format,
+                        own_mixer_spec.channels, own_mixer_spec.freq) < 0) {
+      SDL_FreeWAV(buffer);
+      return(NULL);
+  }
+  cvt.len = length;
+  cvt.buf = SDL_malloc(length * cvt.len_mult);
+  chunk = SDL_malloc(sizeof(Mix_Chunk));
+  if (cvt.buf == NULL || chunk == NULL) {
+      SDL_free(cvt.buf);
+      SDL_free(chunk);
+      SDL_FreeWAV(buffer);
+      return(NULL);
+  }
+  memcpy(cvt.buf, buffer, length);
+  SDL_FreeWAV(buffer);
+  SDL_ConvertAudio(&cvt);
+
+  chunk->allocated = TRUE;
+  chunk->abuf = cvt.buf;
+  chunk->alen = cvt.len_cvt;
+  chunk->volume = MIX_MAX_VOLUME;
+  return(chunk);
+}
+
+
+void Mix_FreeChunk(Mix_Chunk *chunk)
+{
+  if (chunk == NULL) return;
+  if (chunk->allocated == TRUE) SDL_free(chunk->abuf);
+  SDL_free(chunk);
+}
+
+
+Mix_Chunk * Mix_QuickLoad_RAW(Uint8 *mem, Uint32 len)    // already in the device format
+{
+  Mix_Chunk *chunk;
+
+  chunk = SDL_malloc(sizeof(Mix_Chunk));
+  if (chunk == NULL) return(NULL);
+  chunk->allocated = FALSE;
+  chunk->abuf = mem;
+  chunk->alen = len;
+  chunk->volume = MIX_MAX_VOLUME;
+  return(chunk);
+}
+#endif
+
+
+#define __________a
+#define ___PACK___b
+#define __________c
+
+/* ---------------------------------------------------------------------
+   -   Asset pack (../data/munchkin.pak)                               -
+   -   header, index of PACK_MAX_ENTRIES, then the data                -
+   --------------------------------------------------------------------- */
+
+void open_pack()
+{
+  const pack_header_type *header;
+  const pack_entry_type *entries;
+  const void *data;
+  size_t size;
+  int i;
+#if defined(MUNCHKIN_EMBED)
+  data = munchkin_pak;                            // compiled in, nothing to open
+  size = sizeof(munchkin_pak);
+#elif defined(_WIN32)
+  HANDLE file, mapping;
+
+  file = CreateFileA(PACK_FILE, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 
+                     FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) return;       // no pack: use the files in data/
+  size = GetFileSize(file, NULL);
+  mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (mapping == NULL) return;
+  data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);                           // the view keeps the mapping
+  if (data == NULL) return;
+#else
+  int fd;
+  struct stat st;
+
+  fd = open(PACK_FILE, O_RDONLY);
+  if (fd < 0) return;                             // no pack: use the files in data/
+  if (fstat(fd, &st) != 0) {
+      close(fd);
+      return;
+  }
+  size = st.st_size;
+  data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);                                      // the mapping stays valid
+  if (data == MAP_FAILED) return;
+#ifdef MADV_WILLNEED
+  madvise((void *)data, size, MADV_WILLNEED);     // read it in one go, not page by page
+#endif
+#endif
+
+  // check the index once, after this the entries are used without checks
+  header = data;
+  entries = (const pack_entry_type *)(header + 1);
+  if (size < sizeof(pack_header_type) + PACK_MAX_ENTRIES * sizeof(pack_entry_type) ||
+      memcmp(header->magic, "MPAK", 4) != 0 || header->version != PACK_VERSION ||
+      header->num_entries > PACK_MAX_ENTRIES) {
+      fprintf(stderr, "%s is not a pack of this version, make it again with --make-pack\n", PACK_FILE);
+      return;
+  }
+  for (i = 0; i < header->num_entries; i++) {
+      if (entries[i].offset > size || entries[i].size > size - entries[i].offset ||
+          memchr(entries[i].name, 0, sizeof(entries[i].name)) == NULL) {
+          fprintf(stderr, "%s is damaged, make it again with --make-pack\n", PACK_FILE);
+          return;
+      }
+  }
+
+  pack_data = data;
+  pack_size = size;
+  pack_header = header;
+  pack_entries = entries;
+  printf("using %s (%d entries)\n", PACK_FILE, (int)header->num_entries);
+}
+
+
+const pack_entry_type * find_pack_entry(const char *name)
+{
+  int i;
+
+  if (pack_data == NULL) return(NULL);
+  for (i = 0; i < pack_header->num_entries; i++)
+      if (strcmp(pack_entries[i].name, name) == 0) return(&pack_entries[i]);
+  return(NULL);
+}
+
+
+int load_image_from_pack(int i)
+{
+  const pack_entry_type *entry;
+  SDL_Texture *texture;
+
+  // only raw entries are uploaded from the pack, QOI ones are decoded by decode_image()
+  entry = find_pack_entry(image_names[i]);
+  if (entry == NULL || entry->encoding != PACK_RAW || entry->size != entry->w * entry->h * 4) 
+      return(FALSE);
+
+  texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STATIC, 
+                              entry->w, entry->h);
+  if (texture == NULL) return(FALSE);
+  SDL_UpdateTexture(texture, NULL, pack_data + entry->offset, entry->w * 4);
+  SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+  images_textures[i] = texture;
+  return(TRUE);
+}
+
+
+Mix_Chunk * load_sound_from_pack(int i)
+{
+  const pack_entry_type *entry;
+  SDL_AudioCVT cvt;
+  int frequency, channels;
+  Uint16 format;
+
+  if (pack_data == NULL || Mix_QuerySpec(&frequency, &format, &channels) == 0) return(NULL);
+  entry = find_pack_entry(sound_names[i]);
+  if (entry == NULL) return(NULL);
+
+  // in the device format the samples are played straight from the pack
+  if (frequency == pack_header->audio_frequency && format == pack_header->audio_format &&
+      channels == pack_header->audio_channels)
+      return(Mix_QuickLoad_RAW((Uint8 *)(pack_data + entry->offset), entry->size));
+
+  // else convert a copy (the pack may be compiled in, there are no .wav files then)
+  if (SDL_BuildAudioCVT(&cvt, pack_header->audio_format, pack_header->audio_channels, 
+                        pack_header->audio_frequency, format, channels, frequency) < 0) return(NULL);
+  cvt.len = entry->size;
+  cvt.buf = SDL_malloc(cvt.len * cvt.len_mult);       // kept for the whole game, like sounds[]
+  if (cvt.buf == NULL) return(NULL);
+  memcpy(cvt.buf, pack_data + entry->offset, entry->size);
+  if (SDL_ConvertAudio(&cvt) < 0) {
+      SDL_free(cvt.buf);
+      return(NULL);
+  }
+  return(Mix_QuickLoad_RAW(cvt.buf, cvt.len_cvt));
+}
+
+
+void write_pack()
+{
+  FILE *f;
+  pack_header_type header;
+  pack_entry_type entries[PACK_MAX_ENTRIES];
+  SDL_Surface *image;
+  Uint32 *pixels, *row, transparent;
+  Uint8 *qoi;
+  Mix_Chunk *music;
+  void *font;
+  size_t font_size_bytes;
+  int i, x, y, frequency, channels, num_entries, qoi_size;
+  Uint16 format;
+
+  f = fopen(PACK_FILE, "wb");
+  if (f == NULL) {
+      fprintf(stderr, "Cannot write %s: %s\n", PACK_FILE, strerror(errno));
+      exit(1);
+  }
+  memset(&header, 0, sizeof(header));
+  memset(entries, 0, sizeof(entries));
+  fwrite(&header, sizeof(header), 1, f);          // written again at the end
+  fwrite(entries, sizeof(entries), 1, f);
+  num_entries = 0;
+
+  // images as SDL_CreateTextureFromSurface() would make them: white is transparent
+  for (i = 0; i < NUM_IMAGES; i++) {
+      if (!image_used(i)) continue;
+      image = load_image_surface(i);
+      pixels = malloc(image->w * image->h * 4);
+      qoi = malloc(QOI_MAX_SIZE(image->w, image->h));
+      if (pixels == NULL || qoi == NULL) {
+          fprintf(stderr, "Out of memory\n");
+          exit(1);
+      }
+      SDL_LockSurface(image);
+      if (SDL_GetColorKey(image, &transparent) != 0) transparent = 0;    // no key: nothing to replace
+      for (y = 0; y < image->h; y++) {
+          row = (Uint32 *)((Uint8 *)image->pixels + y * image->pitch);
+          for (x = 0; x < image->w; x++)
+              pixels[y * image->w + x] = (row[x] == transparent) ? row[x] & ~image->format->Amask : row[x];
+      }
+      SDL_UnlockSurface(image);
+
+      // mostly transparent sprites: QOI is a fraction of the raw size
+      qoi_size = qoi_encode(pixels, image->w, image->h, qoi);
+      if (qoi_size < image->w * image->h * 4)
+          num_entries = add_pack_entry(f, entries, num_entries, image_names[i], qoi, 
+                                       qoi_size, image->w, image->h, PACK_QOI);
+      else
+          num_entries = add_pack_entry(f, entries, num_entries, image_names[i], pixels, 
+                                       image->w * image->h * 4, image->w, image->h, PACK_RAW);
+      free(pixels);
+      free(qoi);
+      SDL_FreeSurface(image);
+  }
+
+  // sounds as Mix_LoadWAV() converted them for the device
+  Mix_QuerySpec(&frequency, &format, &channels);
+  for (i = 0; i < FIRST_MUSIC; i++)
+      num_entries = add_pack_entry(f, entries, num_entries, sound_names[i], 
+                                   sounds[i]->abuf, sounds[i]->alen, 0, 0, PACK_RAW);
+  for (i = FIRST_MUSIC; i < NUM_SOUNDS; i++) {     // streamed from the pack, not loaded by the game
+      music = Mix_LoadWAV(sound_names[i]);
+      if (music == NULL) {
+          fprintf(stderr, "Cannot load %s: %s\n", sound_names[i], SDL_GetError());
+          exit(1);
+      }
+      num_entries = add_pack_entry(f, entries, num_entries, sound_names[i], 
+                                   music->abuf, music->alen, 0, 0, PACK_RAW);
+      Mix_FreeChunk(music);
+  }
+
+  font = SDL_LoadFile("O2.ttf", &font_size_bytes);
+  if (font == NULL) {
+      fprintf(stderr, "Cannot read O2.ttf: %s\n", SDL_GetError());
+      exit(1);
+  }
+  num_entries = add_pack_entry(f, entries, num_entries, "O2.ttf", font, font_size_bytes, 0, 0, PACK_RAW);
+  SDL_free(font);
+
+  memcpy(header.magic, "MPAK", 4);
+  header.version = PACK_VERSION;
+  header.num_entries = num_entries;
+  header.audio_frequency = frequency;
+  header.audio_format = format;
+  header.audio_channels = channels;
+  fseek(f, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, f);
+  fwrite(entries, sizeof(entries), 1, f);
+  if (fclose(f) != 0) {
+      fprintf(stderr, "Cannot write %s: %s\n", PACK_FILE, strerror(errno));
+      exit(1);
+  }
+  printf("%s written: %d entries, audio %d Hz %d channel(s)\n", PACK_FILE, num_entries, frequency, channels);
+}
+
+
+void write_embedded_pack()
+{
+  FILE *f;
+  Uint8 *data;
+  size_t size, i;
+
+  data = SDL_LoadFile(PACK_FILE, &size);
+  if (data == NULL) {
+      fprintf(stderr, "Cannot read %s: %s\n", PACK_FILE, SDL_GetError());
+      exit(1);
+  }
+  f = fopen("munchkin_pak.h", "w");
+  if (f == NULL) {
+      fprintf(stderr, "Cannot write munchkin_pak.h: %s\n", strerror(errno));
+      exit(1);
+  }
+
+  // aligned like the mapped file, so the 16 byte aligned entries stay aligned
+  fprintf(f, "/* written by munchkin --make-embedded from %s, do not edit */\n", PACK_FILE);
+  fprintf(f, "#if defined(__GNUC__)\n__attribute__((aligned(16)))\n#elif defined(_MSC_VER)\n__declspec(align(16))\n#endif\n");
+  fprintf(f, "static const Uint8 munchkin_pak[%lu] = {", (unsigned long)size);
+  for (i = 0; i < size; i++)
+      fprintf(f, "%s%u,", (i % 20 == 0) ? "\n" : "", data[i]);
+  fprintf(f, "\n};\n");
+  SDL_free(data);
+  if (fclose(f) != 0) {
+      fprintf(stderr, "Cannot write munchkin_pak.h: %s\n", strerror(errno));
+      exit(1);
+  }
+  printf("munchkin_pak.h written (%lu bytes), compile with -DMUNCHKIN_EMBED\n", (unsigned long)size);
+}
+
+
+int add_pack_entry(FILE *f, pack_entry_type *entries, int num_entries, const char *name,
+                   const void *data, Uint32 size, int w, int h, int encoding)
+{
+  static const Uint8 zeros[16];
+  long offset;
+  int i;
+
+  for (i = 0; i < num_entries; i++)
+      if (strcmp(entries[i].name, name) == 0) return(num_entries);   // dummy.wav is used 10 times
+  if (num_entries == PACK_MAX_ENTRIES || strlen(name) >= sizeof(entries[0].name)) {
+      fprintf(stderr, "Cannot add %s to the pack\n", name);
+      exit(1);
+  }
+
+  // 16 byte aligned, so the pixels and samples can be used from the mapping as they are
+  offset = ftell(f);
+  if (offset % 16 != 0) fwrite(zeros, 16 - offset % 16, 1, f);
+  offset = ftell(f);
+
+  strcpy(entries[num_entries].name, name);
+  entries[num_entries].offset = offset;
+  entries[num_entries].size = size;
+  entries[num_entries].w = w;
+  entries[num_entries].h = h;
+  entries[num_entries].encoding = encoding;
+  if (fwrite(data, 1, size, f) != size) {
+      fprintf(stderr, "Cannot write %s: %s\n", PACK_FILE, strerror(errno));
+      exit(1);
+  }
+  return(num_entries + 1);
+}
+
+
+SDL_Surface * decode_image(int i)
+{
+  const pack_entry_type *entry;
+  SDL_Surface *image;
+
+  entry = find_pack_entry(image_names[i]);
+  if (entry != NULL && entry->encoding == PACK_QOI) {
+      // RGBA8888 with alpha: no conversion or colour key needed
+      image = SDL_CreateRGBSurfaceWithFormat(0, entry->w, entry->h, 32, SDL_PIXELFORMAT_RGBA8888);
+      if (image != NULL && image->pitch == entry->w * 4 &&
+          qoi_decode(pack_data + entry->offset, entry->size, entry->w, entry->h, image->pixels) == TRUE)
+          return(image);
+      fprintf(stderr, "Cannot decode %s from the pack, using the file\n", image_names[i]);
+      if (image != NULL) SDL_FreeSurface(image);
+  }
+  return(load_image_surface(i));
+}
+
+
+/* QOI, "Quite OK Image format" (qoiformat.org), 4 channels.
+   Pixels are RGBA8888 (0xRRGGBBAA), the stream has r, g, b, a bytes */
+#define QOI_OP_INDEX  0x00
+#define QOI_OP_DIFF   0x40
+#define QOI_OP_LUMA   0x80
+#define QOI_OP_RUN    0xc0
+#define QOI_OP_RGB    0xfe
+#define QOI_OP_RGBA   0xff
+#define QOI_MASK      0xc0
+#define QOI_HASH(r, g, b, a) (((r) * 3 + (g) * 5 + (b) * 7 + (a) * 11) % 64)
+
+int qoi_encode(const Uint32 *pixels, int w, int h, Uint8 *out)
+{
+  static const Uint8 end_marker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+  Uint32 index[64], px, prev;
+  int i, n, run, hash, r, g, b, a, vr, vg, vb;
+
+  memcpy(out, "qoif", 4);
+  out[4] = w >> 24;  out[5] = w >> 16;  out[6] = w >> 8;  out[7] = w;
+  out[8] = h >> 24;  out[9] = h >> 16;  out[10] = h >> 8; out[11] = h;
+  out[12] = 4;                                 // RGBA
+  out[13] = 0;                                 // sRGB
+  n = 14;
+
+  memset(index, 0, sizeof(index));
+  prev = 0x000000ff;
+  run = 0;
+  for (i = 0; i < w * h; i++) {
+      px = pixels[i];
+      if (px == prev) {
+          run++;
+          if (run == 62 || i == w * h - 1) {
+              out[n++] = QOI_OP_RUN | (run - 1);
+              run = 0;
+          }
+          continue;
+      }
+      if (run > 0) {
+          out[n++] = QOI_OP_RUN | (run - 1);
+          run = 0;
+      }
+
+      r = px >> 24;  g = (px >> 16) & 0xff;  b = (px >> 8) & 0xff;  a = px & 0xff;
+      hash = QOI_HASH(r, g, b, a);
+      if (index[hash] == px) {
+          out[n++] = QOI_OP_INDEX | hash;
+      } else {
+          index[hash] = px;
+          if (a == (prev & 0xff)) {
+              vr = (signed char)(r - (prev >> 24));
+              vg = (signed char)(g - ((prev >> 16) & 0xff));
+              vb = (signed char)(b - ((prev >> 8) & 0xff));
+              if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                  out[n++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+              } else if (vr - vg > -9 && vr - vg < 8 && vg > -33 && vg < 32 && vb - vg > -9 && vb - vg < 8) {
+                  out[n++] = QOI_OP_LUMA | (vg + 32);
+                  out[n++] = (vr - vg + 8) << 4 | (vb - vg + 8);
+              } else {
+                  out[n++] = QOI_OP_RGB;
+                  out[n++] = r;  out[n++] = g;  out[n++] = b;
+              }
+          } else {
+              out[n++] = QOI_OP_RGBA;
+              out[n++] = r;  out[n++] = g;  out[n++] = b;  out[n++] = a;
+          }
+      }
+      prev = px;
+  }
+  memcpy(out + n, end_marker, 8);
+  return(n + 8);
+}
+
+
+int qoi_decode(const Uint8 *data, Uint32 size, int w, int h, Uint32 *pixels)
+{
+  Uint32 index[64];
+  int i, p, end, run, b1, b2, r, g, b, a, vg;
+
+  if (size < 14 + 8 || memcmp(data, "qoif", 4) != 0 || data[12] != 4 ||
+      ((data[4] << 24) | (data[5] << 16) | (data[6] << 8) | data[7]) != w ||
+      ((data[8] << 24) | (data[9] << 16) | (data[10] << 8) | data[11]) != h) return(FALSE);
+
+  memset(index, 0, sizeof(index));
+  r = 0;  g = 0;  b = 0;  a = 255;
+  run = 0;
+  p = 14;
+  end = size - 8;                              // end marker
+  for (i = 0; i < w * h; i++) {
+      if (run > 0) {
+          run--;
+      } else if (p < end) {
+          b1 = data[p++];
+          if (b1 == QOI_OP_RGB) {
+              if (p + 3 > end) return(FALSE);
+              r = data[p];  g = data[p + 1];  b = data[p + 2];
+              p += 3;
+          } else if (b1 == QOI_OP_RGBA) {
+              if (p + 4 > end) return(FALSE);
+              r = data[p];  g = data[p + 1];  b = data[p + 2];  a = data[p + 3];
+              p += 4;
+          } else if ((b1 & QOI_MASK) == QOI_OP_INDEX) {
+              r = index[b1] >> 24;  g = (index[b1] >> 16) & 0xff;
+              b = (index[b1] >> 8) & 0xff;  a = index[b1] & 0xff;
+          } else if ((b1 & QOI_MASK) == QOI_OP_DIFF) {
+              r = (r + ((b1 >> 4) & 3) - 2) & 0xff;
+              g = (g + ((b1 >> 2) & 3) - 2) & 0xff;
+              b = (b + (b1 & 3) - 2) & 0xff;
+          } else if ((b1 & QOI_MASK) == QOI_OP_LUMA) {
+              if (p + 1 > end) return(FALSE);
+              b2 = data[p++];
+              vg = (b1 & 0x3f) - 32;
+              r = (r + vg - 8 + ((b2 >> 4) & 0x0f)) & 0xff;
+              g = (g + vg) & 0xff;
+              b = (b + vg - 8 + (b2 & 0x0f)) & 0xff;
+          } else {                             // QOI_OP_RUN
+              run = b1 & 0x3f;
+          }
+          index[QOI_HASH(r, g, b, a)] = (Uint32)r << 24 | g << 16 | b << 8 | a;
+      } else {
+          return(FALSE);                       // stream ends before the image
+      }
+      pixels[i] = (Uint32)r << 24 | g << 16 | b << 8 | a;
+  }
+  return(TRUE);
+}
+
+
+#define _______________a
+#define ___AUTOPILOT___b
+#define _______________c
+
+/* ---------------------------------------------------------------------
+   -   Autopilot: BFS over the maze cells                              -
+   --------------------------------------------------------------------- */
+
+Uint32 autopilot_actions()       // every game frame: the direction to hold
+{
+  int target[NUM_VERT_CELLS][NUM_HORI_CELLS], avoid[NUM_VERT_CELLS][NUM_HORI_CELLS];
+  int cell_x, cell_y, ghost_x, ghost_y, next_x, next_y, direction, i;
+
+  // between the cell centres keep going, handle_munchkin() turns only on the boundaries
+  if ((munchkin_x_factor1 - (MAZE_OFFSET_X + 7)) % (HORI_LINE_SIZE - 2) == 0 &&
+      (munchkin_y_factor1 - (MAZE_OFFSET_Y + 4)) % (VERT_LINE_SIZE - 2) == 0 &&
+      autopilot_cell(munchkin_x_factor1, munchkin_y_factor1, &cell_x, &cell_y) == TRUE) {
+
+      memset(target, 0, sizeof(target));
+      memset(avoid, 0, sizeof(avoid));
+      for (i = 0; i < NUM_PILLS; i++)
+          if (pills[i].status != 0 && 
+              autopilot_cell(pills[i].x / SUBPIXELS, pills[i].y / SUBPIXELS, &next_x, &next_y) == TRUE)
+              target[next_y][next_x] = TRUE;
+
+      // ghosts: normal ones and the cells next to them are avoided, magenta ones hunted
+      for (i = 0; i < NUM_GHOSTS; i++) {
+          if (autopilot_cell(ghosts[i].x, ghosts[i].y, &ghost_x, &ghost_y) == FALSE) continue;
+          if (ghosts[i].status == 2 && powerpill_active_timer > 0) target[ghost_y][ghost_x] = TRUE;
+          if (ghosts[i].status != 1) continue;
+          avoid[ghost_y][ghost_x] = TRUE;
+          for (direction = LEFT; direction <= DOWN; direction++)
+              if (autopilot_step(ghost_x, ghost_y, direction, &next_x, &next_y) == TRUE)
+                  avoid[next_y][next_x] = TRUE;
+      }
+
+      direction = autopilot_search(cell_x, cell_y, target, avoid);
+      if (direction == 0) {                    // boxed in: any way that is not next to a ghost
+          for (i = LEFT; i <= DOWN && direction == 0; i++)
+              if (autopilot_step(cell_x, cell_y, i, &next_x, &next_y) == TRUE && avoid[next_y][next_x] == FALSE)
+                  direction = i;
+      }
+      if (direction == 0) {                    // else the nearest pill, ghosts or not
+          memset(avoid, 0, sizeof(avoid));
+          direction = autopilot_search(cell_x, cell_y, target, avoid);
+      }
+      autopilot_direction = direction;
+  }
+
+  switch (autopilot_direction) {
+    case LEFT:  return(ACTION_LEFT);
+    case RIGHT: return(ACTION_RIGHT);
+    case UP:    return(ACTION_UP);
+    case DOWN:  return(ACTION_DOWN);
+  }
+  return(0);
+}
+
+
+int autopilot_search(int from_x, int from_y, int target[NUM_VERT_CELLS][NUM_HORI_CELLS],
+                     int avoid[NUM_VERT_CELLS][NUM_HORI_CELLS])    // first direction, 0 = none
+{
+  int first[NUM_VERT_CELLS][NUM_HORI_CELLS];   // direction of the first step to the cell, 0 = not seen
+  int queue[NUM_VERT_CELLS * NUM_HORI_CELLS];
+  int head, tail, cell_x, cell_y, next_x, next_y, direction;
+
+  memset(first, 0, sizeof(first));
+  head = 0;
+  tail = 0;
+  queue[tail++] = from_y * NUM_HORI_CELLS + from_x;
+  first[from_y][from_x] = -1;
+
+  while (head < tail) {
+      cell_x = queue[head] % NUM_HORI_CELLS;
+      cell_y = queue[head] / NUM_HORI_CELLS;
+      head++;
+      if (target[cell_y][cell_x] == TRUE && first[cell_y][cell_x] > 0) return(first[cell_y][cell_x]);
+
+      for (direction = LEFT; direction <= DOWN; direction++) {
+          if (autopilot_step(cell_x, cell_y, direction, &next_x, &next_y) == FALSE) continue;
+          if (first[next_y][next_x] != 0 || avoid[next_y][next_x] == TRUE) continue;
+          first[next_y][next_x] = (first[cell_y][cell_x] > 0) ? first[cell_y][cell_x] : direction;
+          queue[tail++] = next_y * NUM_HORI_CELLS + next_x;
+      }
+  }
+  return(0);
+}
+
+
+int autopilot_step(int cell_x, int cell_y, int direction, int *next_x, int *next_y)    // TRUE: no wall
+{
+  *next_x = cell_x;
+  *next_y = cell_y;
+  switch (direction) {
+    case LEFT:
+      if (vertical_lines[cell_y].line[cell_x] == '|') return(FALSE);
+      *next_x = (cell_x == 0) ? NUM_HORI_CELLS - 1 : cell_x - 1;      // tunnel
+      break;
+    case RIGHT:
+      if (vertical_lines[cell_y].line[cell_x + 1] == '|') return(FALSE);
+      *next_x = (cell_x == NUM_HORI_CELLS - 1) ? 0 : cell_x + 1;
+      break;
+    case UP:
+      if (cell_y == 0 || horizontal_lines[cell_y].line[cell_x] == 'x') return(FALSE);
+      *next_y = cell_y - 1;
+      break;
+    case DOWN:
+      if (cell_y == NUM_VERT_CELLS - 1 || horizontal_lines[cell_y + 1].line[cell_x] == 'x') return(FALSE);
+      *next_y = cell_y + 1;
+      break;
+  }
+  return(TRUE);
+}
+
+
+int autopilot_cell(int x, int y, int *cell_x, int *cell_y)    // pixel position to cell, FALSE: outside
+{
+  if (x < MAZE_OFFSET_X || y < MAZE_OFFSET_Y) return(FALSE);           // in the tunnel
+  *cell_x = (x - MAZE_OFFSET_X) / (HORI_LINE_SIZE - 2);
+  *cell_y = (y - MAZE_OFFSET_Y) / (VERT_LINE_SIZE - 2);
+  return(*cell_x < NUM_HORI_CELLS && *cell_y < NUM_VERT_CELLS);
+}
+
+
+#define ______________a
+#define ___SNAPSHOT___b
+#define ______________c
+
+/* ---------------------------------------------------------------------
+   -   Snapshots: the whole game as one flat blob                      -
+   --------------------------------------------------------------------- */
+
+int game_rand()                  // rand() for the game, the seed is part of the game state
+{
+  game_seed = game_seed * 1103515245 + 12345;
+  return((game_seed >> 16) & 0x7fff);
+}
+
+
+void seed_random(Uint32 seed)
+{
+  srand(seed);                   // title screen
+  game_seed = seed;
+}
+
+
+void save_game_state(game_state_type *state)     // the globals to one blob, without pointers
+{
+  state->magic = GAME_STATE_MAGIC;
+  state->size = sizeof(game_state_type);
+  memcpy(state->horizontal_lines, horizontal_lines, sizeof(horizontal_lines));
+  memcpy(state->vertical_lines, vertical_lines, sizeof(vertical_lines));
+  memcpy(state->pills, pills, NUM_PILLS * sizeof(pill_type));        // the unused ones as 0
+  memset(state->pills + NUM_PILLS, 0, (99 - NUM_PILLS) * sizeof(pill_type));
+  memcpy(state->ghosts, ghosts, NUM_GHOSTS * sizeof(ghost_type));
+  memset(state->ghosts + NUM_GHOSTS, 0, (16 - NUM_GHOSTS) * sizeof(ghost_type));
+  state->num_pills = NUM_PILLS;
+  state->num_ghosts = NUM_GHOSTS;
+  state->munchkin_x_factor1 = munchkin_x_factor1;
+  state->munchkin_y_factor1 = munchkin_y_factor1;
+  state->munchkin_auto_direction = munchkin_auto_direction;
+  state->munchkin_last_direction = munchkin_last_direction;
+  state->speed = speed;
+  state->munchkin_animation_frame = munchkin_animation_frame;
+  state->munchkin_dying_animation = munchkin_dying_animation;
+  state->munchkin_dying = munchkin_dying;
+  state->maze_center_open = maze_center_open;
+  state->maze_completed = maze_completed;
+  state->maze_completed_animations = maze_completed_animations;
+  state->maze_color = maze_color;
+  state->maze_selected = maze_selected;
+  state->arcade_mode = arcade_mode;
+  state->last_pill_speed_increased = last_pill_speed_increased;
+  state->powerpill_color = powerpill_color;
+  state->powerpill_active_timer = powerpill_active_timer;
+  state->score = score;
+  state->frame = frame;
+  state->start_delay = start_delay;
+  state->game_seed = game_seed;
+  state->high_score = high_score;
+  state->high_score_broken = high_score_broken;
+  state->high_score_registration = high_score_registration;
+  state->high_score_character_pos = high_score_character_pos;
+  state->flash_high_score_timer = flash_high_score_timer;
+  memcpy(state->high_score_name, high_score_name, sizeof(high_score_name));
+  state->autopilot_direction = autopilot_direction;
+}
+
+
+void load_game_state(const game_state_type *state)
+{
+  NUM_PILLS = state->num_pills;
+  NUM_GHOSTS = state->num_ghosts;
+  memcpy(horizontal_lines, state->horizontal_lines, sizeof(horizontal_lines));
+  memcpy(vertical_lines, state->vertical_lines, sizeof(vertical_lines));
+  memcpy(pills, state->pills, NUM_PILLS * sizeof(pill_type));
+  memcpy(ghosts, state->ghosts, NUM_GHOSTS * sizeof(ghost_type));
+  munchkin_x_factor1 = state->munchkin_x_factor1;
+  munchkin_y_factor1 = state->munchkin_y_factor1;
+  munchkin_auto_direction = state->munchkin_auto_direction;
+  munchkin_last_direction = state->munchkin_last_direction;
+  speed = state->speed;
+  munchkin_animation_frame = state->munchkin_animation_frame;
+  munchkin_dying_animation = state->munchkin_dying_animation;
+  munchkin_dying = state->munchkin_dying;
+  maze_center_open = state->maze_center_open;
+  maze_completed = state->maze_completed;
+  maze_completed_animations = state->maze_completed_animations;
+  maze_color = state->maze_color;
+  maze_selected = state->maze_selected;
+  arcade_mode = state->arcade_mode;
+  last_pill_speed_increased = state->last_pill_speed_increased;
+  powerpill_color = state->powerpill_color;
+  powerpill_active_timer = state->powerpill_active_timer;
+  score = state->score;
+  frame = state->frame;
+  start_delay = state->start_delay;
+  game_seed = state->game_seed;
+  high_score = state->high_score;
+  high_score_broken = state->high_score_broken;
+  high_score_registration = state->high_score_registration;
+  high_score_character_pos = state->high_score_character_pos;
+  flash_high_score_timer = state->flash_high_score_timer;
+  memcpy(high_score_name, state->high_score_name, sizeof(high_score_name));
+  autopilot_direction = state->autopilot_direction;
+}
+
+
+void save_snapshot()             // F5
+{
+  save_game_state(&quick_state);
+  quick_state_saved = TRUE;
+  if (state_file != NULL) write_state_file(state_file, &quick_state);
+}
+
+
+void restore_snapshot()          // F9
+{
+  if (quick_state_saved == FALSE) return;
+  load_game_state(&quick_state);
+  clear_rewind();
+}
+
+
+void write_checkpoint()          // --checkpoint N, F9 keeps the F5 snapshot
+{
+  game_state_type state;
+
+  if (state_file == NULL) return;
+  save_game_state(&state);
+  write_state_file(state_file, &state);
+}
+
+
+int write_state_file(char *file_name, const game_state_type *state)    // FALSE: not written
+{
+  char temp_name[300];
+  FILE * f;
+  int ok;
+
+  // write next to it and rename, a crash while writing keeps the last checkpoint
+  snprintf(temp_name, sizeof(temp_name), "%s.tmp", file_name);
+  f = fopen(temp_name, "wb");
+  if (f == NULL) {
+      fprintf(stderr, "Cannot write state file %s: %s\n", temp_name, strerror(errno));
+      return(FALSE);
+  }
+  ok = (fwrite(state, sizeof(game_state_type), 1, f) == 1);
+  if (fclose(f) != 0) ok = FALSE;
+#ifdef _WIN32
+  if (ok) remove(file_name);     // rename() does not replace there
+#endif
+  if (ok) ok = (rename(temp_name, file_name) == 0);
+  if (!ok) fprintf(stderr, "Cannot write state file %s\n", file_name);
+  return(ok);
+}
+
+
+int read_state_file(char *file_name, game_state_type *state)    // FALSE: not there or not usable
+{
+  FILE * f;
+  int ok;
+
+  f = fopen(file_name, "rb");
+  if (f == NULL) return(FALSE);
+  ok = (fread(state, sizeof(game_state_type), 1, f) == 1);
+  fclose(f);
+
+  // same build only: the blob is the struct in memory
+  if (!ok || state->magic != GAME_STATE_MAGIC || state->size != sizeof(game_state_type) ||
+      state->num_pills < 1 || state->num_pills > 99 || state->num_ghosts < 1 || state->num_ghosts > 16) {
+      fprintf(stderr, "State file %s is not from this version, ignored\n", file_name);
+      return(FALSE);
+  }
+  return(TRUE);
+}
+
+
+#define ____________a
+#define ___REWIND___b
+#define ____________c
+
+/* ---------------------------------------------------------------------
+   -   Rewind: game frames as XOR against a keyframe, run length coded -
+   --------------------------------------------------------------------- */
+
+void record_rewind_frame()       // end of every arcade game frame
+{
+  game_state_type state;
+  Uint8 delta[sizeof(game_state_type)];
+  rewind_entry_type *entry;
+  const Uint8 *now, *key;
+  int n, i;
+
+  save_game_state(&state);
+
+  // room for the longest entry: the oldest go, a keyframe with all the deltas on it
+  while (rewind_count > 0 &&
+         (rewind_count == REWIND_FRAMES || rewind_bytes_used + REWIND_MAX_ENTRY > REWIND_BYTES)) {
+      do {
+          rewind_bytes_used -= rewind_entries[rewind_oldest % REWIND_FRAMES].size;
+          rewind_oldest++;
+          rewind_count--;
+      } while (rewind_count > 0 && rewind_entries[rewind_oldest % REWIND_FRAMES].keyframe != rewind_oldest);
+  }
+
+  n = rewind_oldest + rewind_count;
+  entry = &rewind_entries[n % REWIND_FRAMES];
+  now = (const Uint8 *)&state;
+  if (rewind_count == 0 || n - rewind_entries[(n - 1) % REWIND_FRAMES].keyframe >= REWIND_KEYFRAME) {
+      entry->keyframe = n;       // against zero
+      memcpy(delta, now, sizeof(delta));
+  } else {
+      entry->keyframe = rewind_entries[(n - 1) % REWIND_FRAMES].keyframe;
+      load_rewind_keyframe(entry->keyframe);
+      key = (const Uint8 *)&rewind_key_state;
+      for (i = 0; i < (int)sizeof(delta); i++) delta[i] = now[i] ^ key[i];
+  }
+
+  entry->start = rewind_write;
+  entry->size = rewind_encode(delta, sizeof(delta));
+  rewind_bytes_used += entry->size;
+  rewind_count++;
+
+  if (entry->keyframe == n) {    // the next deltas are against this one
+      rewind_key_state = state;
+      rewind_key_entry = n;
+  }
+}
+
+
+void rewind_frame()              // Backspace held: one recorded frame back, drawn as it was
+{
+  game_state_type state;
+  rewind_entry_type *entry;
+  int n;
+
+  n = rewind_oldest + rewind_count - 1;
+  if (rewind_count > 1) {        // the newest is the frame on the screen now
+      entry = &rewind_entries[n % REWIND_FRAMES];
+      rewind_write = entry->start;
+      rewind_bytes_used -= entry->size;
+      rewind_count--;
+      if (rewind_key_entry == n) rewind_key_entry = -1;    // its number comes again
+      n--;
+  }
+
+  entry = &rewind_entries[n % REWIND_FRAMES];
+  load_rewind_keyframe(entry->keyframe);
+  state = rewind_key_state;
+  if (entry->keyframe != n) rewind_decode(entry->start, (Uint8 *)&state, sizeof(state));
+
+  load_game_state(&state);
+  set_ambient_sound(0);
+  draw_game_scene();             // also runs the animations,
+  load_game_state(&state);       // the game goes on from the recorded frame
+}
+
+
+void load_rewind_keyframe(int n)    // to rewind_key_state
+{
+  if (rewind_key_entry == n) return;
+  memset(&rewind_key_state, 0, sizeof(rewind_key_state));
+  rewind_decode(rewind_entries[n % REWIND_FRAMES].start, (Uint8 *)&rewind_key_state, sizeof(rewind_key_state));
+  rewind_key_entry = n;
+}
+
+
+void clear_rewind()              // new game or snapshot loaded: no way back
+{
+  rewind_oldest = 0;
+  rewind_count = 0;
+  rewind_bytes_used = 0;
+  rewind_key_entry = -1;
+}
+
+
+int rewind_encode(const Uint8 *in, int size)    // to rewind_ring, returns the bytes written
+{
+  Uint32 start;
+  int i, run;
+
+  // byte b < 128: b + 1 zeros; b >= 128: b - 127 bytes follow
+  // (at worst 3 bytes for every 2, see REWIND_MAX_ENTRY and check_rewind_coding())
+  start = rewind_write;
+  i = 0;
+  while (i < size) {
+      run = 1;
+      if (in[i] == 0) {
+          while (i + run < size && run < 128 && in[i + run] == 0) run++;
+          rewind_ring[rewind_write++ & (REWIND_BYTES - 1)] = run - 1;
+      } else {
+          while (i + run < size && run < 128 && in[i + run] != 0) run++;
+          rewind_ring[rewind_write++ & (REWIND_BYTES - 1)] = run + 127;
+          while (run-- > 0) rewind_ring[rewind_write++ & (REWIND_BYTES - 1)] = in[i++];
+          continue;
+      }
+      i += run;
+  }
+  return(rewind_write - start);
+}
+
+
+void rewind_decode(Uint32 start, Uint8 *out, int size)    // XOR into out
+{
+  int i, run;
+  Uint8 b;
+
+  i = 0;
+  while (i < size) {
+      b = rewind_ring[start++ & (REWIND_BYTES - 1)];
+      if (b < 128) {
+          i += b + 1;
+      } else {
+          for (run = b - 127; run > 0 && i < size; run--) out[i++] ^= rewind_ring[start++ & (REWIND_BYTES - 1)];
+      }
+  }
+}
+
+
+#define _________a
+#define ___ENV___b
+#define _________c
+
+/* ---------------------------------------------------------------------
+   -   Env API: many games stepped without window or sound             -
+   --------------------------------------------------------------------- */
+
+void game_tick(Uint32 actions)   // one game frame without drawing, same order as game()
+{
+  int drawing;
+
+  // draw_munchkin(), draw_pills() and draw_maze() also run the animations and the
+  // rotating maze centre, with skip_drawing they do only that
+  drawing = skip_drawing;
+  skip_drawing = TRUE;
+
+  frame++;
+  move_munchkin(actions);
+  draw_munchkin();
+  if (maze_completed == TRUE) handle_maze_completed();
+  handle_pills();
+  draw_pills();
+  if (munchkin_dying == FALSE || munchkin_dying_animation == 0) handle_ghosts();
+  if (maze_completed == FALSE) check_ghosts_hits_munchkin();
+  draw_maze();
+
+  skip_drawing = drawing;
+}
+
+
+env_type * env_create(int n_envs, int maze, int num_pills, int num_ghosts,
+                      env_observation_type *observations, int *rewards, Uint8 *dones, Uint8 *frames)
+{
+  env_type * env;
+
+  if (n_envs < 1 || maze < 1 || maze > 4 || num_pills < 12 || num_pills > 99 ||
+      num_ghosts < 1 || num_ghosts > ENV_MAX_GHOSTS) {
+      fprintf(stderr, "env_create: n_envs >= 1, maze 1..4, pills 12..99 and ghosts 1..%d\n", ENV_MAX_GHOSTS);
+      return(NULL);
+  }
+  env = calloc(1, sizeof(env_type));
+  if (env == NULL) return(NULL);
+  env->games = calloc(n_envs, sizeof(game_state_type));
+  if (env->games == NULL) {
+      free(env);
+      return(NULL);
+  }
+  env->n_envs = n_envs;
+  env->maze = maze;
+  env->num_pills = num_pills;
+  env->num_ghosts = num_ghosts;
+  env->observations = observations;
+  env->rewards = rewards;
+  env->dones = dones;
+  env->frames = frames;
+
+  MAZE_OFFSET_X =  9;            // as setup(), there is no window
+  MAZE_OFFSET_Y = 23;
+  maze_zoom = SUBPIXELS;
+  return(env);
+}
+
+
+void env_destroy(env_type *env)
+{
+  if (env == NULL) return;
+  free(env->games);
+  free(env);
+}
+
+
+void env_reset(env_type *env, Uint32 seed)     // game i gets seed + i
+{
+  int i;
+
+  for (i = 0; i < env->n_envs; i++) {
+      env_start_game(env, i, seed + i);
+      env_observe(&env->observations[i]);
+      if (env->frames != NULL) env_draw_frame(env->frames + (size_t)i * ENV_FRAME_W * ENV_FRAME_H);
+      env->rewards[i] = 0;
+      env->dones[i] = FALSE;
+  }
+}
+
+
+void env_step(env_type *env, const Uint8 *actions, int n_envs)   // ACTION_* bits per game
+{
+  int i, last_score;
+
+  if (n_envs > env->n_envs) n_envs = env->n_envs;
+
+  for (i = 0; i < n_envs; i++) {
+      load_game_state(&env->games[i]);
+      if (munchkin_dying == TRUE || maze_completed == TRUE)   // done last step: a new game
+          env_start_game(env, i, game_seed);
+      last_score = score;
+
+      game_tick(actions[i]);
+
+      env->rewards[i] = score - last_score;
+      env->dones[i] = (munchkin_dying == TRUE || maze_completed == TRUE);
+      env_observe(&env->observations[i]);
+      if (env->frames != NULL) env_draw_frame(env->frames + (size_t)i * ENV_FRAME_W * ENV_FRAME_H);
+      save_game_state(&env->games[i]);
+  }
+}
+
+
+void env_start_game(env_type *env, int i, Uint32 seed)
+{
+  game_seed = seed;
+  frame = 0;
+  maze_selected = env->maze;
+  arcade_mode = FALSE;
+  NUM_PILLS = env->num_pills;
+  NUM_GHOSTS = env->num_ghosts;
+  start_new_game();
+  save_game_state(&env->games[i]);
+}
+
+
+void env_observe(env_observation_type *observation)    // the loaded game
+{
+  int x, y, i, walls;
+
+  for (y = 0; y < NUM_VERT_CELLS; y++) {
+      for (x = 0; x < NUM_HORI_CELLS; x++) {
+          walls = 0;
+          if (vertical_lines[y].line[x] == '|')       walls |= ENV_WALL_LEFT;
+          if (vertical_lines[y].line[x + 1] == '|')   walls |= ENV_WALL_RIGHT;
+          if (horizontal_lines[y].line[x] == 'x')     walls |= ENV_WALL_UP;
+          if (horizontal_lines[y + 1].line[x] == 'x') walls |= ENV_WALL_DOWN;
+          observation->walls[y][x] = walls;
+      }
+  }
+
+  observation->munchkin[0] = munchkin_x_factor1;
+  observation->munchkin[1] = munchkin_y_factor1;
+  observation->munchkin[2] = munchkin_dying;
+
+  for (i = 0; i < NUM_PILLS; i++) {
+      observation->pills[i][0] = pills[i].x / SUBPIXELS;     // maze_zoom in the game
+      observation->pills[i][1] = pills[i].y / SUBPIXELS;
+      observation->pills[i][2] = pills[i].status;
+  }
+  memset(observation->pills[NUM_PILLS], 0, (99 - NUM_PILLS) * sizeof(observation->pills[0]));
+  for (i = 0; i < NUM_GHOSTS; i++) {
+      observation->ghosts[i][0] = ghosts[i].x;
+      observation->ghosts[i][1] = ghosts[i].y;
+      observation->ghosts[i][2] = ghosts[i].status;
+  }
+  memset(observation->ghosts[NUM_GHOSTS], 0, (ENV_MAX_GHOSTS - NUM_GHOSTS) * sizeof(observation->ghosts[0]));
+  observation->powerpill_active_timer = (powerpill_active_timer > 0) ? powerpill_active_timer : 0;
+}
+
+
+void env_draw_frame(Uint8 *pixels)    // the loaded game as boxes in ENV_* palette indices
+{
+  int i, j, colour;
+
+  memset(pixels, ENV_BLACK, ENV_FRAME_W * ENV_FRAME_H);
+
+  colour = (maze_color == 'm') ? ENV_MAZE_MAGENTA : ENV_MAZE_YELLOW;
+  for (j = 0; j < NUM_HORI_LINES_COL; j++)
+      for (i = 0; i < NUM_HORI_CELLS; i++)
+          if (horizontal_lines[j].line[i] == 'x')
+              env_fill(pixels, MAZE_OFFSET_X + i * (HORI_LINE_SIZE - 2), MAZE_OFFSET_Y + j * (VERT_LINE_SIZE - 2),
+                       HORI_LINE_SIZE, 2, colour);
+  for (j = 0; j < NUM_VERT_CELLS; j++)
+      for (i = 0; i < NUM_VERT_LINES_ROW; i++)
+          if (vertical_lines[j].line[i] == '|')
+              env_fill(pixels, MAZE_OFFSET_X + i * (HORI_LINE_SIZE - 2), MAZE_OFFSET_Y + j * (VERT_LINE_SIZE - 2),
+                       2, VERT_LINE_SIZE, colour);
+
+  for (i = 0; i < NUM_PILLS; i++)
+      if (pills[i].status != 0)
+          env_fill(pixels, pills[i].x / SUBPIXELS, pills[i].y / SUBPIXELS, 3, 2,
+                   (pills[i].status == 1) ? ENV_PILL : ENV_POWERPILL);
+
+  for (i = 0; i < NUM_GHOSTS; i++) {
+      if (ghosts[i].status == 1) colour = ghosts[i].colour;
+        else if (ghosts[i].status == 2) colour = 5;     // magenta
+          else colour = 7;                              // white, eaten or recharging
+      env_fill(pixels, ghosts[i].x, ghosts[i].y, 8, 8, ENV_GHOST + colour);
+  }
+
+  if (munchkin_dying == FALSE || munchkin_dying_animation < 8)
+      env_fill(pixels, munchkin_x_factor1, munchkin_y_factor1, 8, 8, ENV_MUNCHKIN);
+}
+
+
+void env_fill(Uint8 *pixels, int x, int y, int w, int h, Uint8 colour)    // clipped to the frame
+{
+  int j;
+
+  if (x < 0) { w += x; x = 0; }
+  if (y < 0) { h += y; y = 0; }
+  if (x + w > ENV_FRAME_W) w = ENV_FRAME_W - x;
+  if (y + h > ENV_FRAME_H) h = ENV_FRAME_H - y;
+  if (w <= 0 || h <= 0) return;
+
+  for (j = y; j < y + h; j++) memset(pixels + j * ENV_FRAME_W + x, colour, w);
+}
+
+
+void run_env_bench(int n_envs)    // --env-bench N: steps per second with random directions
+{
+  env_type * env;
+  env_observation_type * observations;
+  int * rewards;
+  Uint8 * dones, * actions;
+  int i, steps, games, points;
+  Uint64 start;
+  double seconds;
+
+  if (n_envs < 1) n_envs = 1;
+  observations = malloc(n_envs * sizeof(env_observation_type));
+  rewards = malloc(n_envs * sizeof(int));
+  dones = malloc(n_envs);
+  actions = malloc(n_envs);
+  env = env_create(n_envs, 1, 12, 4, observations, rewards, dones, NULL);
+  if (env == NULL || observations == NULL || rewards == NULL || dones == NULL || actions == NULL) {
+      fprintf(stderr, "--env-bench: out of memory\n");
+      exit(1);
+  }
+  env_reset(env, 1);
+
+  steps = games = points = 0;
+  start = SDL_GetPerformanceCounter();
+  do {
+      for (i = 0; i < n_envs; i++)      // a new direction now and then, like a player
+          if (steps % 16 == 0) actions[i] = 1 << (rand() % 4);
+      env_step(env, actions, n_envs);
+      for (i = 0; i < n_envs; i++) {
+          points += rewards[i];
+          games += dones[i];
+      }
+      steps++;
+      seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+  } while (seconds < 3.0);
+
+  printf("env bench: %d games x %d steps in %.2f s = %.0f steps/s (%d games ended, %d points)\n",
+         n_envs, steps, seconds, n_envs * (double)steps / seconds, games, points);
+  env_destroy(env);
+  exit(0);
+}
+
+
+#define ____________a
+#define ___GOLDEN___b
+#define ____________c
+
+/* ---------------------------------------------------------------------
+   -   Golden image test: known scenes are drawn headless with fixed   -
+   -   random numbers and compared with DIR/<scene>.ppm                -
+   --------------------------------------------------------------------- */
+
+void run_golden_test()
+{
+  int i, k;
+  char name[40];
+
+  /* title screen */
+  seed_random(1);
+  frame = 100;
+  maze_selected = 1;
+  arcade_mode = FALSE;
+  NUM_GHOSTS = 4;
+  NUM_PILLS = 12;
+  powerpill_color = 1;
+  if (title_textures_factor != factor) prerender_title_screen();
+  switch_active_mini_map(maze_selected);
+  SDL_SetRenderDrawColor( gRenderer, 0x0, 0x0, 0x0, 0x0 );
+  SDL_RenderClear(gRenderer);  
+  display_instructions(0, 145);
+  display_active_option_row(1);
+  display_select_game((VIDEOPAC_RES_W / 2) - (12*4), 15);
+  check_golden_image("title");
+  MAZE_OFFSET_X = 9;  MAZE_OFFSET_Y = 23;
+  maze_zoom = SUBPIXELS;
+
+  /* start of maze 1..4 */
+  for (k = 1; k <= 4; k++) {
+     seed_random(k);
+     frame = 1;
+     maze_selected = k;
+     start_new_game();
+     draw_game_scene();
+     sprintf(name, "maze%d_start", k);
+     check_golden_image(name);
+  }
+
+  /* powerpill flash cycle, draw_pills() flashes every 20th frame */
+  seed_random(1);
+  frame = 1;
+  maze_selected = 1;
+  start_new_game();
+  powerpill_color = 1;
+  for (i = 1; i <= 8; i++) {
+     frame = i * 10;
+     draw_game_scene();
+     sprintf(name, "powerpill_%03d", frame);
+     check_golden_image(name);
+  }
+
+  /* dying animation */
+  seed_random(1);
+  frame = 1;
+  start_new_game();
+  munchkin_dying = TRUE;
+  for (i = 1; i <= 7; i++) {
+     munchkin_dying_animation = i;
+     frame = 1;                     // no next animation step in draw_munchkin()
+     draw_game_scene();
+     sprintf(name, "dying_%d", i);
+     check_golden_image(name);
+  }
+  munchkin_dying = FALSE;
+
+  /* intermissions run as in the game, present_screen() checks every 50th frame */
+  seed_random(1);
+  frame = 0;
+  golden_frame = 0;
+  strcpy(golden_scene, "intermission1");
+  intermission1();
+
+  seed_random(1);
+  frame = 0;
+  golden_frame = 0;
+  strcpy(golden_scene, "intermission2");
+  intermission2();
+  golden_scene[0] = '\0';
+
+  check_rewind_coding();
+
+  if (golden_record == FALSE) printf("golden image test: %d failed\n", golden_failures);
+  exit(golden_failures > 0);
+}
+
+
+void check_rewind_coding()       // worst case of rewind_encode(): zero and non-zero bytes alternate
+{
+  static Uint8 in[sizeof(game_state_type)], out[sizeof(game_state_type)];
+  int i, size;
+
+  for (i = 0; i < (int)sizeof(in); i++) in[i] = (i % 2 == 0) ? 0x5a : 0;
+  clear_rewind();
+  rewind_write = 0;
+  size = rewind_encode(in, sizeof(in));
+  memset(out, 0, sizeof(out));
+  rewind_decode(0, out, sizeof(out));
+  clear_rewind();
+
+  if (size > (int)REWIND_MAX_ENTRY || memcmp(in, out, sizeof(in)) != 0) {
+     fprintf(stderr, "golden test: rewind coding of %d alternating bytes takes %d bytes (max %d)%s\n",
+             (int)sizeof(in), size, (int)REWIND_MAX_ENTRY,
+             (memcmp(in, out, sizeof(in)) != 0) ? ", decoded differs" : "");
+     golden_failures++;
+  }
+}
+
+
+void draw_game_scene()    // same order as the game loop, without moving anything
+{
+  SDL_SetRenderDrawColor( gRenderer, 0x0, 0x0, 0x0, 0x0 );
+  SDL_RenderClear(gRenderer);  
+  draw_munchkin();
+  draw_pills();
+  if (munchkin_dying == FALSE || munchkin_dying_animation <= 3) draw_ghosts();
+  draw_maze();
+  draw_score_line(); 
+}
+
+
+void golden_key_frame()          // called for every frame of a running intermission
+{
+  char name[60];
+
+  golden_frame++;
+  if (golden_frame % 50 == 0) {
+     sprintf(name, "%s_%03d", golden_scene, golden_frame);
+     check_golden_image(name);
+  }
+}
+
+
+void check_golden_image(char *name)
+{
+  char file_name[300];
+  int size, differences, i, j, bad;
+
+  SDL_RenderPresent(gRenderer);     // finish drawing in framebuffer
+  size = VIDEOPAC_RES_W * VIDEOPAC_RES_H * 3;
+  SDL_ConvertPixels(VIDEOPAC_RES_W, VIDEOPAC_RES_H, framebuffer->format->format, 
+                    framebuffer->pixels, framebuffer->pitch,
+                    SDL_PIXELFORMAT_RGB24, golden_now, VIDEOPAC_RES_W * 3);
+
+  sprintf(file_name, "%s/%s.ppm", golden_dir, name);
+  if (golden_record == TRUE) {
+     write_ppm(file_name, golden_now);
+     printf("%-24s recorded\n", name);
+     return;
+  }
+
+  if (read_ppm(file_name, golden_ref) == FALSE) {
+     printf("%-24s FAILED, cannot read %s\n", name, file_name);
+     golden_failures++;
+     return;
+  }
+
+  differences = count_differences(golden_now, golden_ref, size, golden_tolerance);
+  if (differences == 0) {
+     printf("%-24s ok\n", name);
+     return;
+  }
+  printf("%-24s FAILED, %d colour values differ more than %d\n", name, differences, golden_tolerance);
+  golden_failures++;
+
+  // diff image: red where it differs, the new frame darkened elsewhere
+  for (i = 0; i < size; i += 3) {
+     bad = FALSE;
+     for (j = 0; j < 3; j++)
+        if (abs(golden_now[i+j] - golden_ref[i+j]) > golden_tolerance) bad = TRUE;
+     if (bad == TRUE) {
+        golden_ref[i] = 255;  golden_ref[i+1] = 0;  golden_ref[i+2] = 0;
+     } else {
+        for (j = 0; j < 3; j++) golden_ref[i+j] = golden_now[i+j] / 4;
+     }
+  }
+  sprintf(file_name, "%s/%s_diff.ppm", golden_dir, name);
+  write_ppm(file_name, golden_ref);
+}
+
+
+int count_differences(const Uint8 *now, const Uint8 *ref, int size, int tolerance)
+{
+  // no branches in the loop, so the compiler makes SIMD code of it (-O2/-O3)
+  int i, d, differences;
+
+  differences = 0;
+  for (i = 0; i < size; i++) {
+     d = now[i] - ref[i];
+     differences += (d > tolerance) | (d < -tolerance);
+  }
+  return(differences);
+}
+
+
+int read_ppm(char *file_name, Uint8 *pixels)
+{
+  FILE *f;
+  int w, h, max_value, ok;
+
+  f = fopen(file_name, "rb");
+  if (f == NULL) return(FALSE);
+  ok = fscanf(f, "P6 %d %d %d", &w, &h, &max_value) == 3 && fgetc(f) != EOF &&
+       w == VIDEOPAC_RES_W && h == VIDEOPAC_RES_H && max_value == 255 &&
+       fread(pixels, 1, w * h * 3, f) == w * h * 3;
+  fclose(f);
+  return(ok);
+}
+
+
+void write_ppm(char *file_name, Uint8 *pixels)
+{
+  FILE *f;
+
+  f = fopen(file_name, "wb");
+  if (f == NULL) {
+     fprintf(stderr, "Cannot write %s: %s\n", file_name, strerror(errno));
+     exit(1);
+  }
+  fprintf(f, "P6\n%d %d\n255\n", (int)VIDEOPAC_RES_W, (int)VIDEOPAC_RES_H);
+  fwrite(pixels, 1, VIDEOPAC_RES_W * VIDEOPAC_RES_H * 3, f);
+  fclose(f);
+}
+
+
+
+#define ___________a
+#define ___TRACE___b
+#define ___________c
+
+/* ---------------------------------------------------------------------
+   -   Chrome trace (only with -DMUNCHKIN_TRACE)                       -
+   -   every thread writes its own ring buffer, so no locks are needed -
+   --------------------------------------------------------------------- */
+
+#ifdef MUNCHKIN_TRACE
+void trace_add(const char *name, Uint64 start)
+{
+  trace_event_type *event;
+  int n, slot;
+
+  if (trace_buffer == NULL) {       // first event of this thread
+     trace_buffer = calloc(1, sizeof(trace_buffer_type));
+     if (trace_buffer == NULL) return;
+     trace_buffer->thread_id = SDL_ThreadID();
+     slot = SDL_AtomicAdd(&trace_num_buffers, 1);
+     if (slot < TRACE_THREADS) SDL_AtomicSetPtr((void **)&trace_buffers[slot], trace_buffer);
+  }
+
+  n = SDL_AtomicGet(&trace_buffer->count);
+  event = &trace_buffer->events[n % TRACE_EVENTS];
+  event->name = name;
+  event->start = start;
+  event->end = SDL_GetPerformanceCounter();
+  SDL_AtomicSet(&trace_buffer->count, n + 1);     // event is complete, write_trace() may read it
+}
+
+
+void write_trace()
+{
+  FILE *f;
+  trace_buffer_type *buffer;
+  trace_event_type event;
+  double to_us;
+  int i, k, n, first, num_buffers, written;
+
+  f = fopen(TRACE_FILE, "w");
+  if (f == NULL) {
+     fprintf(stderr, "Cannot write %s: %s\n", TRACE_FILE, strerror(errno));
+     return;
+  }
+
+  to_us = 1000000.0 / SDL_GetPerformanceFrequency();
+  num_buffers = SDL_AtomicGet(&trace_num_buffers);
+  if (num_buffers > TRACE_THREADS) num_buffers = TRACE_THREADS;
+  written = 0;
+
+  fprintf(f, "{\"traceEvents\":[\n");
+  for (i = 0; i < num_buffers; i++) {
+     buffer = SDL_AtomicGetPtr((void **)&trace_buffers[i]);
+     if (buffer == NULL) continue;
+     fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%lu,\"args\":{\"name\":\"%s\"}}",
+             (written++ > 0) ? ",\n" : "", (unsigned long)buffer->thread_id, 
+             (buffer->thread_id == trace_main_thread) ? "main" : "worker");
+
+     // only the newest TRACE_EVENTS are still in the ring buffer; the thread may go on
+     // writing while F4 reads it, so copy each event and keep it only when its slot
+     // was not reused meanwhile (count k + TRACE_EVENTS: slot of k is being written)
+     n = SDL_AtomicGet(&buffer->count);
+     SDL_MemoryBarrierAcquire();
+     first = (n > TRACE_EVENTS) ? n - TRACE_EVENTS : 0;
+     for (k = first; k < n; k++) {
+        event = buffer->events[k % TRACE_EVENTS];
+        SDL_MemoryBarrierAcquire();
+        if (SDL_AtomicGet(&buffer->count) >= k + TRACE_EVENTS) continue;
+        fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.1f,\"dur\":%.1f}",
+                event.name, (unsigned long)buffer->thread_id, 
+                (event.start - trace_t0) * to_us, (event.end - event.start) * to_us);
+     }
+  }
+  fprintf(f, "\n]}\n");
+  fclose(f);
+  printf("trace written to %s\n", TRACE_FILE);
+}
+#endif
+
+
 // munchkin.c